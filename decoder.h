@@ -25,8 +25,13 @@
 
 #include <cstdint>
 #include <atomic>
+#include <type_traits>
 #include "inc/demodulator.h"
+#include "inc/fixed.h"
+#include "inc/framing.h"
+#include "inc/lzss.h"
 #include "inc/packet.h"
+#include "inc/profiler.h"
 #include "inc/fifo.h"
 
 namespace quadra
@@ -49,21 +54,34 @@ enum Error
     ERROR_OVERFLOW,
     ERROR_ABORT,
     ERROR_LENGTH,
+    ERROR_BUSY,
 };
 
 template <uint32_t sample_rate,
           uint32_t symbol_rate,
           uint32_t packet_size,
           uint32_t block_size,
-          uint32_t fifo_capacity = 256>
+          uint32_t fifo_capacity = 256,
+          typename T = float,
+          typename Crc = Crc32,
+          uint32_t parity_packets = 0,
+          uint32_t window_bits = 0,
+          uint32_t bits_per_symbol = 4,
+          typename Profiler = NullProfiler,
+          uint32_t num_blocks = 1>
 class Decoder
 {
 public:
     void Init(uint32_t crc_seed)
     {
         demodulator_.Init();
-        packet_.Init(crc_seed);
-        block_.Init();
+        framer_.Init(crc_seed);
+
+        for (uint32_t i = 0; i < num_blocks; i++)
+        {
+            blocks_[i].Init();
+        }
+
         last_symbol_ = 0;
         Reset();
     }
@@ -71,10 +89,17 @@ public:
     void Reset(void)
     {
         demodulator_.Reset();
+        framer_.Reset();
         BeginSync();
 
-        packet_.Reset();
-        block_.Clear();
+        block_offset_ = 0;
+        completed_offset_ = 0;
+        block_index_ = 0;
+        last_block_ = 0;
+        blocks_completed_ = 0;
+        blocks_released_.store(0, std::memory_order_relaxed);
+        block().Clear();
+        decompressor_.Init();
         bytes_received_ = 0;
         total_size_bytes_ = 0;
 
@@ -84,26 +109,52 @@ public:
         FlushSamples();
     }
 
-    void Push(float* buffer, uint32_t length)
+    void Push(T* buffer, uint32_t length)
     {
+        static_assert(!kExternalBuffer, "Use Commit with an external buffer");
+
         if (!samples_.Push(buffer, length))
         {
             overflow_.store(true, std::memory_order_release);
         }
     }
 
-    void Push(float sample)
+    void Push(T sample)
     {
         Push(&sample, 1);
     }
 
+    // With fifo_capacity set to 0, samples are read in place from a
+    // circular buffer owned by the caller, typically one filled by DMA in
+    // halves. Attach the buffer before starting the transfer, and then
+    // commit each chunk of samples once it has been written. Each chunk
+    // must be consumed by Process before the next one is complete.
+    void Attach(const T* buffer, uint32_t length)
+    {
+        static_assert(kExternalBuffer, "fifo_capacity must be 0");
+        samples_.Attach(buffer, length);
+    }
+
+    void Commit(uint32_t length)
+    {
+        static_assert(kExternalBuffer, "fifo_capacity must be 0");
+
+        if (!samples_.Commit(length))
+        {
+            overflow_.store(true, std::memory_order_release);
+        }
+    }
+
     Result Process(void)
     {
         if (state_ == STATE_WRITE)
         {
-            block_.Clear();
-            demodulator_.BeginCarrierSync();
-            BeginSync();
+            if (ProfiledUnpack())
+            {
+                return RESULT_BLOCK_COMPLETE;
+            }
+
+            Resume();
             FlushSamples();
         }
         else if (state_ == STATE_END)
@@ -111,49 +162,47 @@ public:
             return RESULT_END;
         }
 
+        // The readable samples are in at most two spans, the second of which
+        // starts where the buffer wraps around.
         Result result = RESULT_NONE;
-        float sample;
+        const T* span[2];
+        uint32_t length[2];
+        uint32_t available = samples_.Peek(span[0], length[0], span[1]);
+        length[1] = available - length[0];
 
-        while (result == RESULT_NONE && samples_.Pop(sample))
+        for (uint32_t i = 0; i < 2 && result == RESULT_NONE && length[i]; i++)
         {
-            uint8_t symbol;
+            uint32_t consumed;
+            result = ProcessSamples(span[i], length[i], consumed);
+            samples_.Consume(consumed);
+        }
 
-            if (abort_.load(std::memory_order_relaxed))
-            {
-                result = ReportError(ERROR_ABORT);
-            }
-            else if (overflow_.load(std::memory_order_relaxed))
-            {
-                result = ReportError(ERROR_OVERFLOW);
-            }
-            else if (demodulator_.error())
+        return result;
+    }
+
+    // Process samples directly from the given buffer rather than from the
+    // input FIFO. Processing stops when a result other than RESULT_NONE is
+    // produced, and consumed is set to the number of samples processed. The
+    // caller should resubmit any unconsumed samples in its next call.
+    Result Process(const T* buffer, uint32_t length, uint32_t& consumed)
+    {
+        consumed = 0;
+
+        if (state_ == STATE_WRITE)
+        {
+            if (ProfiledUnpack())
             {
-                result = ReportError(ERROR_SYNC);
+                return RESULT_BLOCK_COMPLETE;
             }
-            else if (demodulator_.Process(symbol, sample))
-            {
-                last_symbol_ = symbol;
 
-                if (state_ == STATE_SYNC)
-                {
-                    result = Sync(symbol);
-                }
-                else if (state_ == STATE_META)
-                {
-                    result = GetMetadata(symbol);
-                }
-                else if (state_ == STATE_DECODE)
-                {
-                    result = Decode(symbol);
-                }
-                else if (state_ == STATE_ERROR)
-                {
-                    result = RESULT_ERROR;
-                }
-            }
+            Resume();
+        }
+        else if (state_ == STATE_END)
+        {
+            return RESULT_END;
         }
 
-        return result;
+        return ProcessSamples(buffer, length, consumed);
     }
 
     void Abort(void)
@@ -161,6 +210,18 @@ public:
         abort_.store(true, std::memory_order_relaxed);
     }
 
+    // With num_blocks of 2 or more, the data returned by block_data remains
+    // valid until it's released, and the decoder goes on to receive the
+    // following blocks into its other buffers meanwhile. Blocks are released
+    // in the order in which they were completed. This may be called from
+    // another context, e.g. the flash controller's interrupt.
+    void ReleaseBlock(void)
+    {
+        static_assert(kPipelined, "num_blocks must be at least 2");
+        uint32_t released = blocks_released_.load(std::memory_order_relaxed);
+        blocks_released_.store(released + 1, std::memory_order_release);
+    }
+
     Error error(void)
     {
         return (state_ == STATE_ERROR) ? error_ : ERROR_NONE;
@@ -168,7 +229,48 @@ public:
 
     const uint32_t* block_data(void)
     {
-        return block_.data();
+        if constexpr (kCompressed)
+        {
+            return decompressor_.data();
+        }
+        else
+        {
+            return blocks_[last_block_].data();
+        }
+    }
+
+    // Offset in bytes from the start of the image of the block returned by
+    // block_data. Blocks arrive in order, but a sparse transfer omits those
+    // which are entirely fill bytes.
+    uint32_t block_offset(void)
+    {
+        if constexpr (kCompressed)
+        {
+            return bytes_received_ - block_size;
+        }
+        else
+        {
+            return completed_offset_;
+        }
+    }
+
+    // True if the transfer carries only the pages which differ from the
+    // image already in flash. The pages which it omits must be left as they
+    // are rather than erased.
+    bool delta(void)
+    {
+        return framer_.delta();
+    }
+
+    // Once a delta transfer has ended and every block has been written,
+    // checks the whole image against the checksum sent with the transfer.
+    // read(offset, length) returns a pointer to that many bytes of the image
+    // as it is now, e.g. straight into memory-mapped flash. Other transfers
+    // carry no such checksum, and always pass.
+    template <typename Read>
+    bool VerifyImage(Read&& read)
+    {
+        return framer_.VerifyImage(read);
     }
 
     uint32_t total_size_bytes(void)
@@ -194,30 +296,39 @@ public:
     }
 
     // Accessors for debug and simulation
-    const uint8_t* packet_data(void) {return packet_.data();}
-    uint8_t  packet_byte(void)       {return packet_.last_byte();}
-    float    pll_phase(void)         {return demodulator_.pll_phase();}
-    float    pll_error(void)         {return demodulator_.pll_error();}
-    float    pll_step(void)          {return demodulator_.pll_step();}
-    float    decision_phase(void)    {return demodulator_.decision_phase();}
-    float    signal_power(void)      {return demodulator_.signal_power();}
-    float    agc(void)               {return demodulator_.agc();}
+    const uint8_t* packet_data(void) {return framer_.packet().data();}
+    uint8_t  packet_byte(void)       {return framer_.packet().last_byte();}
+    T        pll_phase(void)         {return demodulator_.pll_phase();}
+    T        pll_error(void)         {return demodulator_.pll_error();}
+    T        pll_step(void)          {return demodulator_.pll_step();}
+    T        decision_phase(void)    {return demodulator_.decision_phase();}
+    T        signal_power(void)      {return demodulator_.signal_power();}
+    T        agc(void)               {return demodulator_.agc();}
     uint32_t state(void)             {return state_;}
-    float    recovered_i(void)       {return demodulator_.recovered_i();}
-    float    recovered_q(void)       {return demodulator_.recovered_q();}
-    float    correlation(void)       {return demodulator_.correlation();}
+    T        recovered_i(void)       {return demodulator_.recovered_i();}
+    T        recovered_q(void)       {return demodulator_.recovered_q();}
+    T        correlation(void)       {return demodulator_.correlation();}
     uint32_t demodulator_state(void) {return demodulator_.state();}
     uint8_t  last_symbol(void)       {return last_symbol_;}
     bool     decide(void)            {return demodulator_.decide();}
     uint32_t samples_available(void) {return samples_.available();}
 
+    // Stage timings, if a profiler other than NullProfiler is used. They
+    // accumulate from Init, across calls to Reset.
+    Profiler& profiler(void)
+    {
+        return demodulator_.profiler();
+    }
+
 protected:
-    static constexpr uint32_t kMarkerLength = 2;
-    static constexpr uint32_t kBlockMarker = 0x03;
-    static constexpr uint32_t kEndMarker   = 0x30;
-    static_assert(packet_size >= 4);
     static_assert(block_size % packet_size == 0);
     static_assert(packet_size % 4 == 0);
+    static constexpr bool kCompressed = (window_bits != 0);
+    static constexpr bool kExternalBuffer = (fifo_capacity == 0);
+    static constexpr bool kPipelined = (num_blocks > 1);
+    static_assert(num_blocks > 0);
+    static_assert(!(kPipelined && kCompressed),
+        "Pipelined blocks aren't supported with compression");
 
     enum State
     {
@@ -226,18 +337,24 @@ protected:
         STATE_WRITE,
         STATE_END,
         STATE_ERROR,
-        STATE_META,
     };
 
-    Fifo<float, fifo_capacity> samples_;
+    std::conditional_t<kExternalBuffer,
+        ExternalFifo<T>, Fifo<T, fifo_capacity>> samples_;
     uint8_t last_symbol_; // For sim
-    Demodulator<sample_rate, symbol_rate> demodulator_;
+    Demodulator<sample_rate, symbol_rate, T, bits_per_symbol, Profiler>
+        demodulator_;
     State state_;
     Error error_;
-    Packet<packet_size> packet_;
-    uint32_t marker_count_;
-    uint32_t marker_code_;
-    Block<block_size> block_;
+    Framer<packet_size, block_size, Crc, bits_per_symbol> framer_;
+    uint32_t block_offset_;
+    uint32_t completed_offset_;
+    Block<block_size, packet_size, parity_packets> blocks_[num_blocks];
+    uint32_t block_index_;
+    uint32_t last_block_;
+    uint32_t blocks_completed_;
+    std::atomic<uint32_t> blocks_released_;
+    BlockDecompressor<block_size, window_bits> decompressor_;
     std::atomic_bool abort_;
     std::atomic_bool overflow_;
     uint32_t bytes_received_;
@@ -249,103 +366,269 @@ protected:
         overflow_.store(false, std::memory_order_release);
     }
 
-    void BeginSync(void)
+    // The buffer into which the current block is being received
+    Block<block_size, packet_size, parity_packets>& block(void)
     {
-        state_ = STATE_SYNC;
-        marker_count_ = kMarkerLength;
-        marker_code_ = 0;
+        return blocks_[block_index_];
     }
 
-    Result Sync(uint8_t symbol)
+    void Resume(void)
     {
-        marker_code_ = (marker_code_ << 4) | symbol;
-        marker_count_--;
+        block().Clear();
+        demodulator_.BeginCarrierSync();
+        BeginSync();
+    }
 
-        if (marker_count_ == 0)
+    // Claim a buffer for the block whose marker has just been received.
+    // Fails if the application still holds all of them.
+    bool AcquireBlock(void)
+    {
+        if constexpr (kPipelined)
         {
-            if (marker_code_ == kBlockMarker)
+            uint32_t released =
+                blocks_released_.load(std::memory_order_acquire);
+
+            if (blocks_completed_ - released >= num_blocks)
             {
-                state_ = (bytes_received_ == 0) ? STATE_META : STATE_DECODE;
-                return RESULT_NONE;
+                return false;
             }
-            else if (marker_code_ == kEndMarker)
+
+            block().Clear();
+        }
+
+        return true;
+    }
+
+    // Hand the completed block over to the application, and resynchronize
+    // to the next block straight away rather than waiting for it to be
+    // written.
+    void CompleteBlock(void)
+    {
+        last_block_ = block_index_;
+        block_index_ = (block_index_ + 1) % num_blocks;
+        blocks_completed_++;
+        demodulator_.BeginCarrierSync();
+        BeginSync();
+    }
+
+    Result ProcessSamples(const T* buffer, uint32_t length,
+        uint32_t& consumed)
+    {
+        consumed = 0;
+
+        if (length == 0)
+        {
+            return RESULT_NONE;
+        }
+
+        // These conditions are checked once per batch rather than per sample
+        if (abort_.load(std::memory_order_relaxed))
+        {
+            return ReportError(ERROR_ABORT);
+        }
+        else if (overflow_.load(std::memory_order_relaxed))
+        {
+            return ReportError(ERROR_OVERFLOW);
+        }
+        else if (demodulator_.error())
+        {
+            return ReportError(ERROR_SYNC);
+        }
+
+        Result result = RESULT_NONE;
+        uint32_t i = 0;
+
+        while (result == RESULT_NONE && i < length && !demodulator_.error())
+        {
+            uint8_t symbol;
+            uint32_t n;
+            bool symbol_valid =
+                demodulator_.Process(symbol, buffer + i, length - i, n);
+            i += n;
+
+            if (symbol_valid)
             {
-                if (bytes_received_ == total_size_bytes_)
+                profiler().Begin();
+                last_symbol_ = symbol;
+
+                if (state_ == STATE_SYNC)
                 {
-                    state_ = STATE_END;
-                    return RESULT_END;
+                    result = Frame(symbol);
                 }
-                else
+                else if (state_ == STATE_DECODE)
                 {
-                    return ReportError(ERROR_LENGTH);
+                    result = Decode(symbol);
                 }
-            }
-            else
-            {
-                return ReportError(ERROR_SYNC);
+                else if (state_ == STATE_ERROR)
+                {
+                    result = RESULT_ERROR;
+                }
+
+                profiler().End(PROFILE_FRAMING);
             }
         }
-        else
+
+        consumed = i;
+        return result;
+    }
+
+    // Decompress the next output block from the last received block.
+    // Returns true if one was completed. Anything past the total size is
+    // padding and is ignored.
+    bool Unpack(void)
+    {
+        if (kCompressed && bytes_received_ < total_size_bytes_ &&
+            decompressor_.Process())
         {
-            return RESULT_NONE;
+            bytes_received_ += block_size;
+            return true;
         }
+
+        return false;
     }
 
-    Result Decode(uint8_t symbol)
+    bool ProfiledUnpack(void)
     {
-        bytes_received_ += packet_.WriteSymbol(symbol);
+        profiler().Begin();
+        bool unpacked = Unpack();
+        profiler().Lap(PROFILE_BLOCK);
+        profiler().End(PROFILE_FRAMING);
+        return unpacked;
+    }
 
-        if (packet_.full())
+    void BeginSync(void)
+    {
+        state_ = STATE_SYNC;
+        framer_.BeginSync();
+    }
+
+    // Receive the markers, metadata and block addresses
+    Result Frame(uint8_t symbol)
+    {
+        FrameEvent event = framer_.Process(symbol);
+
+        if (event == FRAME_BLOCK)
         {
-            if (packet_.valid())
+            // Sparse transfers can't be compressed
+            if (kCompressed && framer_.sparse())
+            {
+                return ReportError(ERROR_SYNC);
+            }
+            else if (!AcquireBlock())
             {
-                block_.AppendPacket(packet_);
-                packet_.Reset();
+                return ReportError(ERROR_BUSY);
+            }
 
-                if (block_.full())
-                {
-                    state_ = STATE_WRITE;
-                    return RESULT_BLOCK_COMPLETE;
-                }
+            block_offset_ = bytes_received_;
+        }
+        else if (event == FRAME_METADATA)
+        {
+            total_size_bytes_ = framer_.total_size_bytes();
+        }
+        else if (event == FRAME_ADDRESS)
+        {
+            if (!framer_.address_valid(bytes_received_))
+            {
+                return ReportError(ERROR_LENGTH);
             }
-            else
+
+            bytes_received_ = framer_.address_offset();
+            block_offset_ = bytes_received_;
+        }
+        else if (event == FRAME_END)
+        {
+            // Any blocks omitted from the end of a sparse transfer are
+            // blank, so they count as received
+            if (framer_.sparse() && bytes_received_ <= total_size_bytes_)
             {
-                return ReportError(ERROR_CRC);
+                bytes_received_ = total_size_bytes_;
             }
 
-            return RESULT_PACKET_COMPLETE;
+            if (bytes_received_ == total_size_bytes_)
+            {
+                state_ = STATE_END;
+                return RESULT_END;
+            }
+            else
+            {
+                return ReportError(ERROR_LENGTH);
+            }
         }
-        else
+        else if (event == FRAME_ERROR_SYNC)
         {
-            return RESULT_NONE;
+            return ReportError(ERROR_SYNC);
+        }
+        else if (event == FRAME_ERROR_CRC)
+        {
+            return ReportError(ERROR_CRC);
         }
+
+        if (framer_.in_block())
+        {
+            state_ = STATE_DECODE;
+        }
+
+        return RESULT_NONE;
     }
 
-    Result GetMetadata(uint8_t symbol)
+    Result Decode(uint8_t symbol)
     {
-        packet_.WriteSymbol(symbol);
+        // When decompressing, progress is counted in output blocks instead
+        auto& packet = framer_.packet();
+        bool is_parity = block().data_full();
 
-        if (packet_.full())
+        if (packet.WriteSymbol(symbol) && !is_parity && !kCompressed)
         {
-            if (packet_.valid())
-            {
-                total_size_bytes_ =
-                    *reinterpret_cast<const uint32_t*>(packet_.data());
-
-                #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-                    total_size_bytes_ = __builtin_bswap32(total_size_bytes_);
-                #endif
+            bytes_received_++;
+        }
 
-                packet_.Reset();
-                state_ = STATE_DECODE;
+        if (packet.full())
+        {
+            if (packet.valid())
+            {
+                block().AppendPacket(packet);
             }
-            else
+            else if (!block().ErasePacket())
             {
                 return ReportError(ERROR_CRC);
             }
-        }
 
-        return RESULT_NONE;
+            packet.Reset();
+            profiler().Lap(PROFILE_PACKET);
+
+            if (block().full())
+            {
+                block().Correct();
+                completed_offset_ = block_offset_;
+                bool unpacked = false;
+
+                if (kCompressed)
+                {
+                    decompressor_.Feed(block().data());
+                    unpacked = Unpack();
+                }
+
+                if (kPipelined)
+                {
+                    CompleteBlock();
+                }
+                else
+                {
+                    state_ = STATE_WRITE;
+                }
+
+                profiler().Lap(PROFILE_BLOCK);
+                return (unpacked || !kCompressed) ? RESULT_BLOCK_COMPLETE :
+                    RESULT_PACKET_COMPLETE;
+            }
+
+            return RESULT_PACKET_COMPLETE;
+        }
+        else
+        {
+            profiler().Lap(PROFILE_PACKET);
+            return RESULT_NONE;
+        }
     }
 
     Result ReportError(Error error)
@@ -0,0 +1,472 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include "inc/crc32.h"
+#include "inc/error_correction.h"
+#include "inc/modulator.h"
+#include "inc/scrambler.h"
+
+namespace quadra
+{
+
+// Encodes a transfer for a Decoder with the same parameters. The symbols
+// and samples are identical to those of a mono, uncompressed signal from
+// encoder.py, including the silence at either end, so a WAV file written
+// from them matches the script's. Samples are generated on demand into
+// the caller's buffers, and storage is needed only for one packet.
+//
+// The caller plans the transfer, as encoder.py's Arrangement does: it
+// starts the transfer with the total size of the image, then writes each
+// block with the time the target needs to write it (and to erase any page
+// it begins), and finally ends the transfer.
+template <uint32_t sample_rate,
+          uint32_t symbol_rate,
+          uint32_t packet_size,
+          uint32_t block_size,
+          typename Crc = Crc32,
+          uint32_t parity_packets = 0,
+          uint32_t bits_per_symbol = 4>
+class Encoder
+{
+public:
+    using SymbolModulator =
+        Modulator<sample_rate, symbol_rate, bits_per_symbol>;
+
+    void Init(uint32_t crc_seed)
+    {
+        modulator_.Init();
+        reed_solomon_.Init();
+        crc_.Init();
+        crc_seed_ = crc_seed;
+        Reset();
+    }
+
+    // Abandons any transfer in progress
+    void Reset(void)
+    {
+        Begin(PHASE_DONE, 0);
+        sample_index_ = kSymbolDuration;
+        samples_ = nullptr;
+    }
+
+    // Begins a transfer of an image of the given size, a multiple of
+    // block_size. If sparse, each block is sent with its index in the image,
+    // and blocks may be omitted as with encoder.py's --sparse option.
+    void Start(uint32_t total_size_bytes, bool sparse = false)
+    {
+        total_size_bytes_ = total_size_bytes;
+        sparse_ = sparse;
+        first_block_ = true;
+        ending_ = false;
+        Begin(PHASE_LEAD_IN, kSilenceLength);
+    }
+
+    // Queues the next block, which must be block_size bytes long. The data
+    // is read as it's sent, so it must remain valid until the encoder is
+    // ready for the next block. The carrier is then held for wait_time
+    // seconds while the target writes the block. Returns false if the
+    // encoder isn't ready for a block.
+    bool WriteBlock(const uint8_t* data, double wait_time,
+        uint32_t index = 0)
+    {
+        if (!ready())
+        {
+            return false;
+        }
+
+        data_ = data;
+        index_ = index;
+        wait_length_ = static_cast<uint32_t>(wait_time * symbol_rate);
+        packet_index_ = 0;
+        reed_solomon_.Reset();
+        marker_ = sparse_ ? kAddressedBlockMarker : kBlockMarker;
+        Begin(PHASE_RESYNC, kResyncLength);
+        return true;
+    }
+
+    // Queues the end of the transfer, after the last block
+    bool End(void)
+    {
+        if (!ready())
+        {
+            return false;
+        }
+
+        ending_ = true;
+        marker_ = kEndMarker;
+        Begin(PHASE_RESYNC, kResyncLength);
+        return true;
+    }
+
+    // True if the encoder is waiting for the next block or the end
+    bool ready(void)
+    {
+        return phase_ == PHASE_IDLE;
+    }
+
+    // True once the transfer has been sent in full, or before it starts
+    bool done(void)
+    {
+        return phase_ == PHASE_DONE && sample_index_ == kSymbolDuration;
+    }
+
+    // Produces the next symbol. Returns false if the encoder is waiting for
+    // the next block or the end, or is done. The silence at either end of
+    // the signal is skipped.
+    bool Process(uint8_t& symbol)
+    {
+        while (!NextSymbol(symbol))
+        {
+            if (phase_ != PHASE_LEAD_IN && phase_ != PHASE_LEAD_OUT)
+            {
+                return false;
+            }
+
+            Advance();
+        }
+
+        return true;
+    }
+
+    // Writes up to length samples to the buffer, and returns the number
+    // written. Fewer are written only if the encoder is waiting for the
+    // next block or the end, or is done.
+    uint32_t Modulate(int16_t* buffer, uint32_t length)
+    {
+        uint32_t n = 0;
+
+        while (n < length)
+        {
+            if (sample_index_ < kSymbolDuration)
+            {
+                uint32_t count = Min(length - n,
+                    kSymbolDuration - sample_index_);
+                std::memcpy(buffer + n, samples_ + sample_index_,
+                    count * sizeof(int16_t));
+                sample_index_ += count;
+                n += count;
+            }
+            else if (phase_ == PHASE_LEAD_IN || phase_ == PHASE_LEAD_OUT)
+            {
+                uint32_t count = Min(length - n, count_);
+                std::memset(buffer + n, 0, count * sizeof(int16_t));
+                count_ -= count;
+                n += count;
+
+                if (count_ == 0)
+                {
+                    Advance();
+                }
+            }
+            else
+            {
+                uint8_t symbol;
+
+                if (!NextSymbol(symbol))
+                {
+                    break;
+                }
+
+                samples_ = modulator_.samples(symbol);
+                sample_index_ = 0;
+            }
+        }
+
+        return n;
+    }
+
+protected:
+    static constexpr uint32_t kSymbolDuration =
+        SymbolModulator::kSymbolDuration;
+    static constexpr uint32_t kAlignmentLength =
+        SymbolModulator::kAlignmentLength;
+    static constexpr uint32_t kDataPackets = block_size / packet_size;
+    static constexpr uint32_t kNumPackets = kDataPackets + parity_packets;
+    static constexpr uint32_t kSymbolMask = (1 << bits_per_symbol) - 1;
+
+    static_assert(packet_size >= 4);
+    static_assert(packet_size % 4 == 0);
+    static_assert(block_size % packet_size == 0);
+
+    // Durations in symbols, or for the silence, in samples
+    static constexpr uint32_t kSilenceLength = sample_rate / 10;
+    static constexpr uint32_t kIntroLength = 1.0 * symbol_rate;
+    static constexpr uint32_t kResyncLength = 0.0375 * symbol_rate;
+
+    // Each marker is two symbols, the first in the high bits
+    static constexpr uint32_t kMarkerLength = 2;
+    static constexpr uint32_t kBlockMarker = 0x03;
+    static constexpr uint32_t kEndMarker   = 0x03 << bits_per_symbol;
+    static constexpr uint32_t kAddressedBlockMarker =
+        kBlockMarker | kEndMarker;
+
+    enum Phase
+    {
+        PHASE_LEAD_IN,
+        PHASE_INTRO,
+        PHASE_IDLE,
+        PHASE_RESYNC,
+        PHASE_ALIGN,
+        PHASE_MARKER,
+        PHASE_METADATA,
+        PHASE_ADDRESS,
+        PHASE_PACKETS,
+        PHASE_WAIT,
+        PHASE_LEAD_OUT,
+        PHASE_DONE,
+    };
+
+    SymbolModulator modulator_;
+    ReedSolomonEncoder<kDataPackets, parity_packets, packet_size>
+        reed_solomon_;
+    Crc crc_;
+    uint32_t crc_seed_;
+
+    Phase phase_;
+    uint32_t count_;
+    uint32_t total_size_bytes_;
+    bool sparse_;
+    bool first_block_;
+    bool ending_;
+    uint32_t marker_;
+
+    const uint8_t* data_;
+    uint32_t index_;
+    uint32_t wait_length_;
+    uint32_t packet_index_;
+
+    // The current packet, with its CRC and Hamming parity, after scrambling
+    uint8_t packet_[packet_size + 6];
+    uint32_t packet_length_;
+    uint32_t byte_index_;
+    uint32_t bits_;
+    uint32_t num_bits_;
+
+    const int16_t* samples_;
+    uint32_t sample_index_;
+
+    static uint32_t Min(uint32_t a, uint32_t b)
+    {
+        return (a < b) ? a : b;
+    }
+
+    static void Store32(uint8_t* data, uint32_t word)
+    {
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            data[i] = word >> (8 * i);
+        }
+    }
+
+    void Begin(Phase phase, uint32_t count)
+    {
+        phase_ = phase;
+        count_ = count;
+    }
+
+    // Returns false if the current phase has no more symbols
+    bool NextSymbol(uint8_t& symbol)
+    {
+        for (;;)
+        {
+            if (phase_ == PHASE_INTRO || phase_ == PHASE_RESYNC ||
+                phase_ == PHASE_WAIT)
+            {
+                if (count_)
+                {
+                    count_--;
+                    symbol = SymbolModulator::carrier_sync_symbol();
+                    return true;
+                }
+            }
+            else if (phase_ == PHASE_ALIGN)
+            {
+                if (count_)
+                {
+                    symbol = SymbolModulator::alignment_symbol(
+                        kAlignmentLength - count_--);
+                    return true;
+                }
+            }
+            else if (phase_ == PHASE_MARKER)
+            {
+                if (count_)
+                {
+                    uint32_t shift = --count_ * bits_per_symbol;
+                    symbol = (marker_ >> shift) & kSymbolMask;
+                    return true;
+                }
+            }
+            else if (phase_ == PHASE_METADATA || phase_ == PHASE_ADDRESS ||
+                phase_ == PHASE_PACKETS)
+            {
+                if (UnpackSymbol(symbol))
+                {
+                    return true;
+                }
+            }
+            else
+            {
+                return false;
+            }
+
+            Advance();
+        }
+    }
+
+    // Moves on from a phase which has finished
+    void Advance(void)
+    {
+        if (phase_ == PHASE_LEAD_IN)
+        {
+            Begin(PHASE_INTRO, kIntroLength);
+        }
+        else if (phase_ == PHASE_INTRO || phase_ == PHASE_WAIT)
+        {
+            Begin(PHASE_IDLE, 0);
+        }
+        else if (phase_ == PHASE_RESYNC)
+        {
+            Begin(PHASE_ALIGN, kAlignmentLength);
+        }
+        else if (phase_ == PHASE_ALIGN)
+        {
+            Begin(PHASE_MARKER, kMarkerLength);
+        }
+        else if (phase_ == PHASE_MARKER && ending_)
+        {
+            Begin(PHASE_LEAD_OUT, kSilenceLength);
+        }
+        else if (phase_ == PHASE_MARKER && first_block_)
+        {
+            // The metadata packet precedes the first block, and isn't
+            // covered by the parity packets
+            first_block_ = false;
+            std::memset(packet_, 0, packet_size);
+            Store32(packet_, total_size_bytes_);
+            EncodePacket(packet_size);
+            Begin(PHASE_METADATA, 0);
+        }
+        else if ((phase_ == PHASE_MARKER || phase_ == PHASE_METADATA) &&
+            sparse_)
+        {
+            // Block addresses are sent in short packets of their own
+            Store32(packet_, index_);
+            EncodePacket(4);
+            Begin(PHASE_ADDRESS, 0);
+        }
+        else if (phase_ == PHASE_PACKETS && packet_index_ == kNumPackets)
+        {
+            Begin(PHASE_WAIT, wait_length_);
+        }
+        else if (phase_ == PHASE_LEAD_OUT)
+        {
+            Begin(PHASE_DONE, 0);
+        }
+        else
+        {
+            // The next data or parity packet
+            const uint8_t* payload;
+
+            if (packet_index_ < kDataPackets)
+            {
+                payload = data_ + packet_index_ * packet_size;
+                reed_solomon_.Process(payload);
+            }
+            else
+            {
+                payload = reed_solomon_.parity(packet_index_ - kDataPackets);
+            }
+
+            std::memcpy(packet_, payload, packet_size);
+            EncodePacket(packet_size);
+            packet_index_++;
+            Begin(PHASE_PACKETS, 0);
+        }
+    }
+
+    // Appends the CRC and Hamming parity to the payload at the start of the
+    // packet buffer, and scrambles the whole packet
+    void EncodePacket(uint32_t length)
+    {
+        crc_.Seed(crc_seed_);
+        Store32(&packet_[length], crc_.Process(packet_, length));
+
+        HammingDecoder hamming;
+        hamming.Init();
+        hamming.Process(static_cast<const uint8_t*>(packet_), length + 4);
+        uint32_t parity = hamming.parity();
+        packet_[length + 4] = parity;
+        packet_[length + 5] = parity >> 8;
+
+        Scrambler scrambler;
+        scrambler.Init();
+        packet_length_ = length + 6;
+
+        for (uint32_t i = 0; i < packet_length_; i++)
+        {
+            packet_[i] = scrambler.Process(packet_[i]);
+        }
+
+        byte_index_ = 0;
+        bits_ = 0;
+        num_bits_ = 0;
+    }
+
+    // Packs the packet's bytes into symbols MSB first, padding the last
+    // symbol. Returns false once the packet has been sent.
+    bool UnpackSymbol(uint8_t& symbol)
+    {
+        if (num_bits_ < bits_per_symbol)
+        {
+            if (byte_index_ < packet_length_)
+            {
+                bits_ = (bits_ << 8) | packet_[byte_index_++];
+                num_bits_ += 8;
+            }
+            else if (num_bits_)
+            {
+                symbol = (bits_ << (bits_per_symbol - num_bits_)) &
+                    kSymbolMask;
+                num_bits_ = 0;
+                return true;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        num_bits_ -= bits_per_symbol;
+        symbol = (bits_ >> num_bits_) & kSymbolMask;
+        bits_ &= (1 << num_bits_) - 1;
+        return true;
+    }
+};
+
+}
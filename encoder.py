@@ -30,7 +30,7 @@
 #
 # -----------------------------------------------------------------------------
 #
-# 16-QAM encoder for converting firmware files into wav files
+# QAM encoder for converting firmware files into wav files
 
 import argparse
 import zlib
@@ -43,6 +43,7 @@ import sys
 import string
 import io
 import itertools
+import collections
 
 
 
@@ -51,7 +52,9 @@ def main():
     parser.add_argument('-s', '--sample-rate', dest='sample_rate',
         type=int,
         required=True,
-        help='Sample rate in Hz. Must be a multiple of the symbol rate.')
+        help='Sample rate in Hz of the output. Must be an integer multiple '
+            'of the symbol rate. The decoder\'s sample rate need not match; '
+            'see the README for its limits.')
     parser.add_argument('-y', '--symbol-rate', dest='symbol_rate',
         type=int,
         required=True,
@@ -92,6 +95,48 @@ def main():
     parser.add_argument('-p', '--packet-size', dest='packet_size',
         default='256',
         help='Packet size in bytes. Must be a multiple of 4. Default 256.')
+    parser.add_argument('-q', '--bits-per-symbol', dest='bits_per_symbol',
+        type=int, choices=[2, 4, 6], default=4,
+        help='Number of bits per symbol, i.e. the base-2 log of the QAM '
+            'constellation size. Must match the decoder. Default 4 (16-QAM).')
+    parser.add_argument('-r', '--parity-packets', dest='parity_packets',
+        default='0',
+        help='Number of Reed-Solomon parity packets to append to each block. '
+            'The decoder can recover up to this many corrupt packets per '
+            'block. Must match the decoder. Default 0.')
+    parser.add_argument('-n', '--channels', dest='num_channels',
+        type=int, choices=[1, 2], default=1,
+        help='Number of audio channels. In stereo, the packets of each block '
+            'alternate between the left and right channels, which nearly '
+            'halves the transfer time. Requires the StereoDecoder. '
+            'Default 1.')
+    parser.add_argument('-c', '--window-bits', dest='window_bits',
+        default='0',
+        help='Compress the data with LZSS using a window of 2^WINDOW_BITS '
+            'bytes, which must be between 8 and 12. Must match the decoder. '
+            'Default 0 (no compression).')
+    parser.add_argument('--block-buffers', dest='block_buffers',
+        type=int, default=1,
+        help='Number of block buffers in the decoder, i.e. its num_blocks '
+            'parameter. With 2 or more, the target writes each block while '
+            'receiving the following ones, so the gaps between blocks need '
+            'only be long enough that a buffer is free when the next block '
+            'begins. Must not exceed the decoder\'s value. Not supported '
+            'with compression or stereo. Default 1.')
+    parser.add_argument('--sparse', dest='sparse',
+        action='store_true',
+        help='Omit blocks which consist entirely of fill bytes, and send '
+            'the index of each remaining block with it. The target must '
+            'still erase any pages which the omitted blocks occupy. Not '
+            'supported with compression or stereo.')
+    parser.add_argument('--base', dest='base_file',
+        default=None,
+        help='Base image (bin or hex) which the target already holds at the '
+            'start address. Only the pages which differ from it are sent, '
+            'and the target leaves the others as they are. The metadata '
+            'then carries a checksum of the whole image for the target to '
+            'verify. Requires a packet size of at least 12. Not supported '
+            'with compression, stereo, or --sparse.')
     parser.add_argument('--fill', dest='fill_byte',
         default='0xFF',
         help='Byte value to use to fill gaps and pad lengths. Default 0xFF.')
@@ -112,6 +157,19 @@ def main():
             'if one is given, otherwise stdout.')
     args = parser.parse_args()
 
+    if args.block_buffers < 1:
+        parser.error('--block-buffers must be at least 1')
+    if args.block_buffers > 1 and (int(args.window_bits, 0) or
+            args.num_channels > 1):
+        parser.error('--block-buffers requires mono and no compression')
+    if args.sparse and (int(args.window_bits, 0) or args.num_channels > 1):
+        parser.error('--sparse requires mono and no compression')
+    if args.base_file and (int(args.window_bits, 0) or
+            args.num_channels > 1 or args.sparse or
+            parse_size(args.packet_size) < 12):
+        parser.error('--base requires mono, no compression, no --sparse, '
+            'and a packet size of at least 12')
+
     if args.input_file == '-':
         input_file = sys.stdin.buffer
         if args.output_file == None:
@@ -128,10 +186,6 @@ def main():
     if input_file is not sys.stdin.buffer:
         input_file.close()
 
-    if args.file_type == 'auto':
-        is_hex = all(map(lambda x: chr(x) in string.hexdigits + ':\r\n', data))
-        args.file_type = 'hex' if is_hex else 'bin'
-
     base_address = int(args.base_address, 0)
     if args.start_address.startswith('+'):
         start_address = base_address + int(args.start_address[1:], 0)
@@ -140,11 +194,15 @@ def main():
 
     fill_byte = int(args.fill_byte, 0)
 
-    if args.file_type == 'hex':
-        from intelhex import IntelHex
-        ihex = IntelHex(io.StringIO(data.decode('ascii')))[start_address:]
-        ihex.padding = fill_byte
-        data = ihex.tobinstr()
+    data = load_image(data, args.file_type, start_address, fill_byte)
+
+    base = None
+    if args.base_file:
+        (root, ext) = os.path.splitext(args.base_file)
+        base_type = ext[1:] if ext in ['.bin', '.hex'] else 'auto'
+        with open(args.base_file, 'rb') as base_file:
+            base = load_image(base_file.read(), base_type, start_address,
+                fill_byte)
 
     if args.output_file == '-':
         output_file = sys.stdout.buffer
@@ -157,85 +215,254 @@ def main():
             block_size    = parse_size(args.block_size),
             fill_byte     = fill_byte,
             write_time    = float(args.write_time),
-            data          = data)
+            data          = data,
+            sparse        = args.sparse,
+            base          = base)
+
+    if base is not None and not arrangement.changed():
+        parser.error('the image is identical to the base image')
+
+    window_bits = int(args.window_bits, 0)
+    if window_bits:
+        arrangement = CompressedArrangement(
+            arrangement = arrangement,
+            block_size  = parse_size(args.block_size),
+            fill_byte   = fill_byte,
+            window_bits = window_bits)
 
     encoder = Encoder(
             symbol_rate = args.symbol_rate,
             packet_size = parse_size(args.packet_size),
-            crc_seed    = int(args.crc_seed, 0))
-
-    symbols = encoder.encode(arrangement)
-
-    assert (args.sample_rate % args.symbol_rate) == 0
-    modulator = Modulator(args.sample_rate, args.symbol_rate)
-    signal = array.array('h')
-    silence = [0] * (args.sample_rate // 10)
-    signal.extend(silence)
-    signal.extend(modulator.modulate(symbols))
-    signal.extend(silence)
+            crc_seed    = int(args.crc_seed, 0),
+            parity_packets = int(args.parity_packets, 0),
+            bits_per_symbol = args.bits_per_symbol,
+            num_channels = args.num_channels,
+            block_buffers = args.block_buffers,
+            sparse = args.sparse,
+            delta = base is not None)
+
+    if (args.sample_rate % args.symbol_rate) != 0:
+        parser.error('--sample-rate must be a multiple of --symbol-rate')
+    modulator = Modulator(args.sample_rate, args.symbol_rate,
+        args.bits_per_symbol)
+    silence = args.sample_rate // 10
 
     writer = wave.open(output_file, 'wb')
     writer.setframerate(args.sample_rate)
     writer.setsampwidth(2)
-    writer.setnchannels(1)
-    writer.writeframes(signal.tobytes())
+    writer.setnchannels(args.num_channels)
+
+    # The signal is encoded, modulated and written a piece at a time. The
+    # header is normally patched with the length once the data is written,
+    # but a pipe can't be rewound, so the symbols are first counted instead.
+    if output_file is sys.stdout.buffer and not output_file.seekable():
+        num_frames = 2 * silence
+        for pieces in encoder.encode(arrangement):
+            num_frames += modulator.length(pieces[0])
+        writer.setnframes(num_frames)
+
+    writer.writeframesraw(bytes(2 * args.num_channels * silence))
+    for pieces in encoder.encode(arrangement):
+        signals = [modulator.modulate(symbols) for symbols in pieces]
+        if len(signals) == 1:
+            frames = signals[0]
+        else:
+            # Interleave the channels into frames
+            frames = array.array('h', bytes(2 * sum(map(len, signals))))
+            for i, signal in enumerate(signals):
+                frames[i::len(signals)] = signal
+        writer.writeframesraw(frames)
+    writer.writeframesraw(bytes(2 * args.num_channels * silence))
     writer.close()
 
 
 
 class Arrangement:
+    # Each block is given with its index in the image and the time which
+    # the target needs to write it. If sparse, blocks of fill bytes are
+    # omitted. The target erases each page when it receives the first block
+    # at or beyond the page's start, so the erase times of any pages which
+    # are wholly omitted carry over to the next block. Given a base image,
+    # the pages which match it are omitted instead, and aren't erased. The
+    # other pages are sent whole, since erasing them loses their contents.
+    # The blocks are produced a page at a time as they're iterated.
     def __init__(self, flash_spec, reserved_size,
-                block_size, fill_byte, write_time, data):
-        self._blocks = []
-        pages = Pages(data, flash_spec, reserved_size, block_size)
-        for (erase_time, page_data) in pages:
-            blocks = Blocks(page_data, block_size, fill_byte)
-            for i, block_data in enumerate(blocks):
-                wait_time = write_time;
-                if i == 0:
-                    wait_time += erase_time
-                self._blocks.append((block_data, wait_time / 1000))
-        self._size = len(self._blocks) * block_size
+                block_size, fill_byte, write_time, data, sparse=False,
+                base=None):
+        self._pages = Pages(data, flash_spec, reserved_size, block_size)
+        self._block_size = block_size
+        self._fill_byte = fill_byte
+        self._write_time = write_time
+        self._sparse = sparse
+        self._base = base
+        self._size = -(-len(data) // block_size) * block_size
 
     def __iter__(self):
-        return iter(self._blocks)
+        block_size = self._block_size
+        blank = bytes([self._fill_byte]) * block_size
+        index = 0
+        erase_time = 0
+        for (page_erase_time, page_data) in self._pages:
+            page_data = b''.join(Blocks(page_data, block_size,
+                self._fill_byte))
+            if self._base is not None:
+                start = index * block_size
+                base_data = self._base[start : start + len(page_data)]
+                base_data += bytes([self._fill_byte]) * (len(page_data) -
+                    len(base_data))
+                if page_data == base_data:
+                    index += len(page_data) // block_size
+                    continue
+            erase_time += page_erase_time
+            for block_data in Blocks(page_data, block_size, self._fill_byte):
+                if not (self._sparse and block_data == blank):
+                    wait_time = self._write_time + erase_time
+                    yield (index, block_data, wait_time / 1000)
+                    erase_time = 0
+                index += 1
 
     def size(self):
         return self._size
 
+    def crc(self, seed):
+        # Checksum of the whole image as the target will hold it, padded to
+        # a block
+        crc = seed
+        for (erase_time, page_data) in self._pages:
+            for block_data in Blocks(page_data, self._block_size,
+                    self._fill_byte):
+                crc = zlib.crc32(block_data, crc)
+        return crc
+
+    def changed(self):
+        return next(iter(self), None) is not None
+
+
+class CompressedArrangement:
+    # Compresses the data of an arrangement as one stream, and splits the
+    # result into blocks. The decoder decompresses each received block as
+    # far as it can, and writes any flash blocks which that completes, so
+    # the wait time after each block is the total for those flash blocks.
+    # The compressor's window spans blocks, so it takes the whole stream.
+    def __init__(self, arrangement, block_size, fill_byte, window_bits):
+        data = []
+        wait_times = []
+        for (index, block_data, wait_time) in arrangement:
+            data.append(block_data)
+            wait_times.append(wait_time)
+        compressed, ends = Lzss(window_bits).compress(b''.join(data),
+            block_size)
+        self._flash_blocks = list(zip(ends, wait_times))
+
+        if len(compressed) % block_size:
+            padding = block_size - (len(compressed) % block_size)
+            compressed += bytes([fill_byte]) * padding
+
+        self._compressed = compressed
+        self._block_size = block_size
+        self._size = arrangement.size()
+
+    def __iter__(self):
+        block_size = self._block_size
+        flash_blocks = iter(self._flash_blocks)
+        flash_block = next(flash_blocks, None)
+        for i in range(0, len(self._compressed), block_size):
+            wait_time = 0
+            while flash_block is not None and flash_block[0] <= i + block_size:
+                wait_time += flash_block[1]
+                flash_block = next(flash_blocks, None)
+            yield (i // block_size, self._compressed[i : i + block_size],
+                wait_time)
+        assert flash_block is None
+
+    def size(self):
+        return self._size
 
-CARRIER_SYNC_PLACEHOLDER = -1
-ALIGNMENT_PLACEHOLDER = -2
+
+# Symbols are held as bytes, and the placeholders take values above those
+# of any symbol
+CARRIER_SYNC_PLACEHOLDER = 0xFF
+ALIGNMENT_PLACEHOLDER = 0xFE
+ALIGNMENT_LENGTH = 16
+
+def popcount(x):
+    return bin(x).count('1')
+
+if hasattr(int, 'bit_count'):
+    popcount = int.bit_count
+
+def symbol_count(symbols):
+    # Each alignment placeholder is modulated as a sequence of symbols
+    alignments = symbols.count(ALIGNMENT_PLACEHOLDER)
+    return len(symbols) + alignments * (ALIGNMENT_LENGTH - 1)
+
+METADATA_DELTA = 1 << 0
 
 class Encoder:
 
-    def __init__(self, symbol_rate, packet_size, crc_seed):
+    def __init__(self, symbol_rate, packet_size, crc_seed, parity_packets=0,
+                bits_per_symbol=4, num_channels=1, block_buffers=1,
+                sparse=False, delta=False):
         assert (packet_size % 4) == 0
+        assert block_buffers == 1 or num_channels == 1
+        assert not (sparse or delta) or num_channels == 1
+        assert not delta or packet_size >= 12
 
         self._symbol_rate = symbol_rate
         self._packet_size = packet_size
         self._crc_seed = crc_seed
-
-        self._block_marker = [0, 3]
-        self._end_marker = [3, 0]
-
-        self._byte_table = []
-        for byte in range(256):
-            self._byte_table.append([
-                ((byte >> 4) & 0xF),
-                ((byte >> 0) & 0xF)])
-
-        self._hamming_table = []
-        bit_num = 1
-        for i in range((packet_size + 4) * 8):
-            while ((bit_num & (bit_num - 1)) == 0):
-                bit_num += 1
-            self._hamming_table.append((bit_num, i // 8, 1 << (i % 8)))
-            bit_num += 1
+        self._reed_solomon = ReedSolomon(parity_packets)
+        self._bits_per_symbol = bits_per_symbol
+        self._num_channels = num_channels
+        self._block_buffers = block_buffers
+        # A delta transfer omits unchanged pages, so its blocks are
+        # addressed like those of a sparse one
+        self._sparse = sparse or delta
+        self._delta = delta
+
+        self._block_marker = bytes([0, 3])
+        self._end_marker = bytes([3, 0])
+        self._addressed_block_marker = bytes([3, 3])
+
+        # The Hamming parity is the XOR of the bit numbers of the set bits,
+        # where the bits are numbered from 3, skipping powers of 2. Bit p of
+        # the parity is therefore the parity of the data bits whose numbers
+        # have bit p set, which we select with one mask per parity bit.
+        num_bits = (packet_size + 4) * 8
+        bit_nums = [n for n in range(3, 2 * num_bits + 3) if n & (n - 1)]
+        # Most significant (i.e. last) bit first, as the masks are built
+        # from binary strings
+        bit_nums = bit_nums[num_bits - 1::-1]
+        self._hamming_masks = [
+            int(''.join('01'[(n >> p) & 1] for n in bit_nums), 2)
+            for p in range(bit_nums[0].bit_length())]
+
+        # The scrambler restarts with every packet, so its output is the
+        # same each time
+        self._keystream = self._make_keystream(packet_size + 6)
+
+        # Tables which split each byte into its symbols, MSB first. With 6
+        # bits per symbol, each 3 bytes make 4 symbols, of which the middle
+        # two straddle bytes.
+        mask = (1 << bits_per_symbol) - 1
+        self._group = 3 if bits_per_symbol == 6 else 1
+        if bits_per_symbol == 6:
+            self._symbol_tables = [
+                [(0, bytes((x >> 2) for x in range(256)))],
+                [(0, bytes((x & 0x03) << 4 for x in range(256))),
+                    (1, bytes((x >> 4) for x in range(256)))],
+                [(1, bytes((x & 0x0F) << 2 for x in range(256))),
+                    (2, bytes((x >> 6) for x in range(256)))],
+                [(2, bytes((x & 0x3F) for x in range(256)))]]
+        else:
+            self._symbol_tables = [
+                [(0, bytes((x >> (8 - bits_per_symbol * (j + 1))) & mask
+                    for x in range(256)))]
+                for j in range(8 // bits_per_symbol)]
 
     def _encode_blank(self, duration):
         length = int(duration * self._symbol_rate)
-        return [CARRIER_SYNC_PLACEHOLDER] * length
+        return bytearray([CARRIER_SYNC_PLACEHOLDER]) * length
 
     def _encode_intro(self):
         return self._encode_blank(1.0)
@@ -243,112 +470,431 @@ class Encoder:
     def _encode_resync(self):
         return self._encode_blank(0.0375)
 
+    def _encode_header(self):
+        symbols = self._encode_resync()
+        symbols.append(ALIGNMENT_PLACEHOLDER)
+        if self._sparse:
+            symbols += self._addressed_block_marker
+        else:
+            symbols += self._block_marker
+        return symbols
+
+    def _duration(self, symbols):
+        return symbol_count(symbols) / self._symbol_rate
+
     def _encode_outro(self):
         symbols = self._encode_resync()
-        symbols += [ALIGNMENT_PLACEHOLDER] + self._end_marker
+        symbols.append(ALIGNMENT_PLACEHOLDER)
+        symbols += self._end_marker
         return symbols
 
-    def _encode_byte(self, byte):
-        return self._byte_table[byte]
+    def _encode_bytes(self, data):
+        # Pack bytes into symbols MSB first, padding the last symbol. The
+        # data is split into groups of bytes which make a whole number of
+        # symbols, and each symbol of every group is computed at once by
+        # translating the bytes which hold its bits.
+        num_symbols = -(-len(data) * 8 // self._bits_per_symbol)
+        group = self._group
+        data += bytes(-len(data) % group)
+        lanes = [data[i::group] for i in range(group)]
+        symbols = bytearray(len(data) * 8 // self._bits_per_symbol)
+        stride = len(self._symbol_tables)
+        for j, parts in enumerate(self._symbol_tables):
+            value = 0
+            for (lane, table) in parts:
+                value |= int.from_bytes(lanes[lane].translate(table), 'big')
+            symbols[j::stride] = value.to_bytes(len(lanes[0]), 'big')
+        return symbols[:num_symbols]
 
     def _hamming(self, data):
+        bits = int.from_bytes(data, 'little')
         parity = 0
-        for (bit_num, byte_num, mask) in self._hamming_table:
-            if data[byte_num] & mask:
-                parity ^= bit_num
+        for p, mask in enumerate(self._hamming_masks):
+            parity |= (popcount(bits & mask) & 1) << p
         return parity
 
-    def _scramble(self, _bytes, seed=0):
+    def _make_keystream(self, length):
         mult = 1664525
         incr = 1013904223
-        state = seed
-        for byte in _bytes:
+        state = 0
+        keystream = bytearray()
+        for i in range(length):
             state = (state * mult + incr) & 0xFFFFFFFF
-            yield byte ^ (state >> 24)
+            keystream.append(state >> 24)
+        return bytes(keystream)
+
+    def _scramble(self, _bytes, length):
+        # The scrambler restarts every length bytes
+        keystream = self._keystream[:length] * (len(_bytes) // length)
+        scrambled = (int.from_bytes(_bytes, 'big') ^
+            int.from_bytes(keystream, 'big'))
+        return scrambled.to_bytes(len(_bytes), 'big')
+
+    def _encode_packets(self, packets):
+        # Returns the symbols of each packet. The packets are all of the
+        # same length, so they are scrambled and packed together, with each
+        # one padded to a whole group of bytes.
+        frames = []
+        for data in packets:
+            # Block addresses are sent in short packets of their own
+            assert len(data) in [self._packet_size, 4]
+            crc = zlib.crc32(data, self._crc_seed) & 0xFFFFFFFF
+            data += struct.pack('<L', crc)
+            data += struct.pack('<H', self._hamming(data))
+            frames.append(data)
+        length = len(frames[0])
+        assert all(len(frame) == length for frame in frames)
+        data = self._scramble(b''.join(frames), length)
+        padding = bytes(-length % self._group)
+        if padding:
+            data = b''.join(data[i : i + length] + padding
+                for i in range(0, len(data), length))
+        symbols = self._encode_bytes(data)
+        count = -(-length * 8 // self._bits_per_symbol)
+        stride = (length + len(padding)) * 8 // self._bits_per_symbol
+        return [symbols[i : i + count]
+            for i in range(0, len(frames) * stride, stride)]
 
     def _encode_packet(self, data):
-        assert len(data) == self._packet_size
-        crc = zlib.crc32(data, self._crc_seed) & 0xFFFFFFFF
-        data += struct.pack('<L', crc)
-        data += struct.pack('<H', self._hamming(data))
-        symbols = []
-        for byte in self._scramble(data):
-            symbols += self._encode_byte(byte)
-        return symbols
+        return self._encode_packets([data])[0]
 
-    def _encode_block(self, data):
+    def _encode_block(self, data, metadata=None, index=None):
+        # Returns the symbols for each channel. The packets alternate between
+        # the channels, and each channel carries the markers and metadata.
         assert (len(data) % self._packet_size) == 0
 
-        symbols = self._encode_resync()
-        symbols += [ALIGNMENT_PLACEHOLDER] + self._block_marker
+        header = self._encode_header()
 
-        for i in range(0, len(data), self._packet_size):
-            packet = data[i : i + self._packet_size]
-            symbols += self._encode_packet(packet)
+        # The metadata packet isn't covered by the parity packets
+        if metadata is not None:
+            header += self._encode_packet(metadata)
 
-        return symbols
+        if self._sparse:
+            header += self._encode_packet(struct.pack('<L', index))
+
+        channels = [bytearray(header) for i in range(self._num_channels)]
+
+        packets = [data[i : i + self._packet_size]
+            for i in range(0, len(data), self._packet_size)]
+        packets += self._reed_solomon.encode(packets)
+        assert len(packets) >= self._num_channels
+
+        for i, symbols in enumerate(self._encode_packets(packets)):
+            channels[i % self._num_channels] += symbols
+
+        # Pad the channels which carry fewer packets to keep them aligned
+        length = max(map(len, channels))
+        for symbols in channels:
+            symbols += bytes([CARRIER_SYNC_PLACEHOLDER]) * (
+                length - len(symbols))
+
+        return channels
 
     def encode(self, blocks):
-        symbols = []
-        symbols += self._encode_intro()
+        # Yields the symbols a piece at a time, as a list with the symbols of
+        # each channel, all of the same length: the intro, then each block
+        # with the gap around it, then the outro.
+        intro = self._encode_intro()
+        yield [intro] * self._num_channels
         size = blocks.size()
 
-        for i, (data, time) in enumerate(blocks):
+        # With several block buffers, the target writes each block while
+        # receiving the following ones. We track when each write will end,
+        # and insert a gap only where a block would otherwise begin while all
+        # of the decoder's buffers are still in use. The block header, which
+        # precedes the point at which the decoder claims a buffer, leaves
+        # some margin for latency on the target.
+        clock = self._duration(intro)
+        write_end = collections.deque(maxlen=self._block_buffers)
+
+        for i, (index, data, time) in enumerate(blocks):
+            metadata = None
             if i == 0:
                 # Prepend metadata packet
                 meta = struct.pack('<L', size)
+                if self._delta:
+                    crc = blocks.crc(self._crc_seed)
+                    meta += struct.pack('<LL', METADATA_DELTA, crc)
                 padding = self._packet_size - len(meta)
-                data = meta + (b'\x00' * padding) + data
-            symbols += self._encode_block(data)
-            symbols += self._encode_blank(time)
+                metadata = meta + (b'\x00' * padding)
+            block = self._encode_block(data, metadata, index)
+
+            if self._block_buffers > 1:
+                gap = 0
+                if len(write_end) == self._block_buffers:
+                    gap = max(0, write_end[0] - clock)
+                blank = (bytearray([CARRIER_SYNC_PLACEHOLDER]) *
+                    math.ceil(gap * self._symbol_rate))
+                clock += self._duration(blank) + self._duration(block[0])
+                start = max([clock] + list(write_end)[-1:])
+                write_end.append(start + time)
+                yield [blank + block[0]]
+            else:
+                yield [block_symbols + self._encode_blank(time)
+                    for block_symbols in block]
+
+        yield [self._encode_outro()] * self._num_channels
+
+
+
+class ReedSolomon:
+    # Systematic Reed-Solomon code over GF(256) which is applied across the
+    # packets of a block. Byte i of each packet belongs to codeword i, and
+    # the first packet holds the highest-order coefficients.
+
+    def __init__(self, num_parity):
+        self._num_parity = num_parity
+
+        self._exp = [0] * 510
+        self._log = [0] * 256
+        x = 1
+        for i in range(255):
+            self._exp[i] = self._exp[i + 255] = x
+            self._log[x] = i
+            x <<= 1
+            if x & 0x100:
+                x ^= 0x11D
+
+        # Generator polynomial with roots 2^0 ... 2^(num_parity-1), highest
+        # order coefficient first
+        self._generator = [1]
+        for i in range(num_parity):
+            self._generator = self._multiply_poly(
+                self._generator, [1, self._exp[i]])
+
+        # Multiplication by each coefficient, as a table with which to
+        # translate a whole packet at once
+        self._generator_tables = [
+            bytes(self._multiply(g, x) for x in range(256))
+            for g in self._generator[1:]]
+
+    def _multiply(self, a, b):
+        if a == 0 or b == 0:
+            return 0
+        return self._exp[self._log[a] + self._log[b]]
+
+    def _multiply_poly(self, p, q):
+        product = [0] * (len(p) + len(q) - 1)
+        for i, a in enumerate(p):
+            for j, b in enumerate(q):
+                product[i + j] ^= self._multiply(a, b)
+        return product
+
+    def encode(self, packets):
+        if self._num_parity == 0:
+            return []
+
+        assert len(packets) + self._num_parity <= 255
+        length = len(packets[0])
+
+        # Every codeword is divided by the generator at once. Each packet
+        # holds one coefficient of every codeword, and the remainders are
+        # held as integers so that they can be added (XORed) in one step.
+        remainder = [0] * self._num_parity
+        for packet in packets:
+            feedback = int.from_bytes(packet, 'big') ^ remainder[0]
+            feedback = feedback.to_bytes(length, 'big')
+            remainder = remainder[1:] + [0]
+            for k, table in enumerate(self._generator_tables):
+                product = feedback.translate(table)
+                remainder[k] ^= int.from_bytes(product, 'big')
+
+        return [r.to_bytes(length, 'big') for r in remainder]
+
+
+
+class Lzss:
+    # Byte-aligned LZSS compressor. Each group of up to 8 items is preceded
+    # by a flag byte, in which bit i is set if item i is a match rather than
+    # a literal byte. A match is a 16-bit little-endian token holding the
+    # distance minus 1 in its low window_bits bits and the length minus
+    # MIN_MATCH in the rest.
+
+    MIN_MATCH = 3
+    MAX_CANDIDATES = 64
+
+    def __init__(self, window_bits):
+        assert 8 <= window_bits <= 12
+        self._window_bits = window_bits
+        self._window_size = 1 << window_bits
+        self._max_match = (1 << (16 - window_bits)) - 1 + self.MIN_MATCH
+
+    def _find_match(self, data, pos, chain):
+        best_length = 0
+        best_distance = 0
+        limit = min(self._max_match, len(data) - pos)
+        for candidate in reversed(chain[-self.MAX_CANDIDATES:]):
+            distance = pos - candidate
+            if distance > self._window_size:
+                break
+            length = 0
+            while (length < limit and
+                    data[candidate + length] == data[pos + length]):
+                length += 1
+            if length > best_length:
+                best_length = length
+                best_distance = distance
+                if length == limit:
+                    break
+        return (best_length, best_distance)
+
+    def compress(self, data, block_size):
+        # Returns the compressed data, and for each block of the input, the
+        # length of compressed data needed to decompress through its end.
+        # Only the most recent candidates of each chain are searched, so the
+        # older ones are dropped.
+        output = bytearray()
+        ends = []
+        chains = {}
+        flag_pos = 0
+        num_items = 8
+        pos = 0
+
+        while pos < len(data):
+            if num_items == 8:
+                flag_pos = len(output)
+                output.append(0)
+                num_items = 0
+
+            key = data[pos : pos + self.MIN_MATCH]
+            chain = chains.setdefault(key, [])
+            length, distance = self._find_match(data, pos, chain)
+
+            if length >= self.MIN_MATCH:
+                output[flag_pos] |= 1 << num_items
+                token = ((distance - 1) |
+                    ((length - self.MIN_MATCH) << self._window_bits))
+                output += struct.pack('<H', token)
+            else:
+                output.append(data[pos])
+                length = 1
 
-        symbols += self._encode_outro()
-        return symbols
+            num_items += 1
+            for i in range(pos, pos + length):
+                chain = chains.setdefault(data[i : i + self.MIN_MATCH], [])
+                chain.append(i)
+                if len(chain) == 2 * self.MAX_CANDIDATES:
+                    del chain[:self.MAX_CANDIDATES]
+                if (i + 1) % block_size == 0:
+                    ends.append(len(output))
+            pos += length
+
+        return (bytes(output), ends)
 
 
 
 class Modulator:
 
-    def __init__(self, sample_rate, symbol_rate):
+    def __init__(self, sample_rate, symbol_rate, bits_per_symbol=4):
         assert (sample_rate % symbol_rate) == 0
+        assert bits_per_symbol in [2, 4, 6]
         symbol_duration = sample_rate // symbol_rate
         self._sample_rate = sample_rate
+        self._bits_per_symbol = bits_per_symbol
         self._symbol_table = self._construct_symbols(symbol_duration)
-        self._carrier_sync_symbol = 0xF
-        self._alignment_sequence = [0x7, 0x3, 0xB, 0xF] * 4
+
+        # The sync symbols are the corners of the constellation
+        self._carrier_sync_symbol = self._corner(True, True)
+        self._alignment_sequence = [
+            self._corner(False, True),
+            self._corner(False, False),
+            self._corner(True, False),
+            self._corner(True, True)] * 4
+        assert len(self._alignment_sequence) == ALIGNMENT_LENGTH
+
+        # Byte k of the samples of each symbol, as a table with which to
+        # translate all of the symbols at once. The carrier sync placeholder
+        # translates as the carrier sync symbol.
+        waveforms = [samples.tobytes() for samples in self._symbol_table]
+        waveforms += [waveforms[self._carrier_sync_symbol]] * (
+            256 - len(waveforms))
+        self._byte_tables = [bytes(waveform[k] for waveform in waveforms)
+            for k in range(len(waveforms[0]))]
+        self._alignment_symbols = bytes(self._alignment_sequence)
+        self._carrier_sync_samples = waveforms[self._carrier_sync_symbol]
+
+    def _constellation(self):
+        # Square constellation in which each axis is Gray coded in
+        # sign-magnitude form. The sign bits of x and y are the two most
+        # significant bits of the symbol, followed by the Gray-coded
+        # magnitudes of y and then x.
+        magnitude_bits = self._bits_per_symbol // 2 - 1
+        mask = (1 << magnitude_bits) - 1
+        levels = [0] * (1 << magnitude_bits)
+        for magnitude in range(len(levels)):
+            levels[magnitude ^ (magnitude >> 1)] = 2 * magnitude + 1
+        constellation = []
+        for symbol in range(1 << self._bits_per_symbol):
+            x = levels[symbol & mask]
+            y = levels[(symbol >> magnitude_bits) & mask]
+            if symbol & (1 << (self._bits_per_symbol - 1)):
+                x = -x
+            if symbol & (1 << (self._bits_per_symbol - 2)):
+                y = -y
+            constellation.append((x, y))
+        return constellation
+
+    def _corner(self, negative_x, negative_y):
+        magnitude_bits = self._bits_per_symbol // 2 - 1
+        magnitude = (1 << magnitude_bits) - 1
+        gray = magnitude ^ (magnitude >> 1)
+        return ((negative_x << (self._bits_per_symbol - 1)) |
+            (negative_y << (self._bits_per_symbol - 2)) |
+            (gray << magnitude_bits) | gray)
 
     def _construct_symbols(self, symbol_duration):
-        constellation = [
-            ( 1,  1), ( 3,  1), ( 1,  3), ( 3,  3),
-            ( 1, -1), ( 3, -1), ( 1, -3), ( 3, -3),
-            (-1,  1), (-3,  1), (-1,  3), (-3,  3),
-            (-1, -1), (-3, -1), (-1, -3), (-3, -3)
-        ]
+        constellation = self._constellation()
+        amplitude = (2 << (self._bits_per_symbol // 2 - 1)) - 1
         lookup = list()
         for x, y in constellation:
             samples = list()
             for i in range(symbol_duration):
                 phase = 2 * math.pi * i / symbol_duration
                 sample = x * math.cos(phase) - y * math.sin(phase)
-                sample /= 3 * math.sqrt(2)
+                sample /= amplitude * math.sqrt(2)
                 assert (sample >= -1) and (sample <= 1)
                 samples.append(int(32767 * sample))
             lookup.append(array.array('h', samples))
         return lookup
 
+    def length(self, symbols):
+        # Number of samples which the symbols modulate to
+        return symbol_count(symbols) * len(self._symbol_table[0])
+
     def modulate(self, symbols):
-        signal = array.array('h')
-        for symbol in symbols:
-            if symbol == ALIGNMENT_PLACEHOLDER:
-                for symbol in self._alignment_sequence:
-                    signal.extend(self._symbol_table[symbol])
-            else:
-                if symbol == CARRIER_SYNC_PLACEHOLDER:
-                    symbol = self._carrier_sync_symbol
-                signal.extend(self._symbol_table[symbol])
-        return signal
+        # Once the alignment sequences are expanded, byte k of every
+        # symbol's samples is found by one translation and stored with a
+        # strided slice. The runs of carrier sync at either end, which make
+        # up much of each piece, just repeat one symbol's samples.
+        carrier_sync = bytes([CARRIER_SYNC_PLACEHOLDER])
+        lead = len(symbols) - len(symbols.lstrip(carrier_sync))
+        symbols = symbols[lead:]
+        body = symbols.rstrip(carrier_sync)
+        trail = len(symbols) - len(body)
+        body = body.replace(bytes([ALIGNMENT_PLACEHOLDER]),
+            self._alignment_symbols)
+        stride = len(self._byte_tables)
+        samples = bytearray(stride * len(body))
+        for k, table in enumerate(self._byte_tables):
+            samples[k::stride] = body.translate(table)
+        return array.array('h', b''.join([
+            self._carrier_sync_samples * lead, samples,
+            self._carrier_sync_samples * trail]))
+
+
+
+def load_image(data, file_type, start_address, fill_byte):
+    if file_type == 'auto':
+        is_hex = all(map(lambda x: chr(x) in string.hexdigits + ':\r\n', data))
+        file_type = 'hex' if is_hex else 'bin'
 
+    if file_type == 'hex':
+        from intelhex import IntelHex
+        ihex = IntelHex(io.StringIO(data.decode('ascii')))[start_address:]
+        ihex.padding = fill_byte
+        data = ihex.tobinstr()
 
+    return data
 
 def parse_size(size):
     if size.upper().endswith('K'):
@@ -357,6 +903,8 @@ def parse_size(size):
         return int(size, 0)
 
 class Pages:
+    # Splits the data into pages, each given with its erase time. The data
+    # of each page is sliced out only as the pages are iterated.
     def __init__(self, data, flash_spec, reserved_size, block_size):
         page_spec = self._page_specs(flash_spec)
 
@@ -365,16 +913,19 @@ class Pages:
             reserved_size -= page_size
         assert reserved_size == 0
 
+        self._data = data
         self._pages = []
-        while len(data) > 0:
+        start = 0
+        while start < len(data):
             (page_size, erase_time) = next(page_spec)
             assert page_size >= block_size
             assert page_size % block_size == 0
-            self._pages.append((erase_time, data[:page_size]))
-            data = data[page_size:]
+            self._pages.append((erase_time, start, page_size))
+            start += page_size
 
     def __iter__(self):
-        return iter(self._pages)
+        for (erase_time, start, page_size) in self._pages:
+            yield (erase_time, self._data[start : start + page_size])
 
     def _page_specs(self, flash_spec):
         for (size, time, num) in map(self._parse_page_spec, flash_spec):
@@ -398,15 +949,15 @@ class Pages:
 
 class Blocks:
     def __init__(self, data, block_size, fill_byte):
-        if len(data) % block_size:
-            padding = block_size - (len(data) % block_size)
-            data += bytes([fill_byte]) * padding
-        assert len(data) % block_size == 0
-        self._blocks = [data[i : i + block_size]
-            for i in range(0, len(data), block_size)]
+        self._data = data
+        self._block_size = block_size
+        self._fill_byte = fill_byte
 
     def __iter__(self):
-        return iter(self._blocks)
+        for i in range(0, len(self._data), self._block_size):
+            block_data = self._data[i : i + self._block_size]
+            padding = self._block_size - len(block_data)
+            yield block_data + bytes([self._fill_byte]) * padding
 
 
 
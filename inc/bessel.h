@@ -0,0 +1,237 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstdint>
+
+namespace quadra
+{
+
+// Compile-time design of digital Bessel low-pass filters as cascades of
+// biquad sections. The result is equivalent to that of
+// scipy.signal.bessel(2 * num_sections, cutoff, output='sos', fs=1), i.e.
+// the phase-normalized analog prototype is transformed by the bilinear
+// transform with prewarping. The cutoff is given in cycles per sample.
+template <uint32_t num_sections>
+class BesselLowpass
+{
+public:
+    struct Biquad
+    {
+        float b[3];
+        float a[2];
+    };
+
+    struct Cascade
+    {
+        Biquad section[num_sections];
+    };
+
+    static constexpr Cascade Design(double cutoff)
+    {
+        Complex poles[kOrder] = {};
+        AnalogPoles(poles);
+
+        // Prewarp, then map each pole with the bilinear transform
+        // s = 2 (z - 1) / (z + 1), with a sample rate of 2
+        constexpr Complex kTwiceRate = {4, 0};
+        double warped = 4 * Tan(kPi * cutoff);
+        Complex gain = {1, 0};
+
+        for (uint32_t i = 0; i < kOrder; i++)
+        {
+            Complex p = poles[i] * Complex{warped, 0};
+            gain = gain * Complex{warped, 0} / (kTwiceRate - p);
+            poles[i] = (kTwiceRate + p) / (kTwiceRate - p);
+        }
+
+        // Each section gets one pole from the upper half plane and its
+        // conjugate, plus a pair of zeros at z = -1. As in scipy, sections
+        // are ordered so that those with poles closest to the unit circle
+        // come last, and the gain is applied in the first section.
+        Cascade cascade{};
+        uint32_t n = 0;
+
+        for (uint32_t i = 0; i < kOrder; i++)
+        {
+            if (poles[i].im > 0)
+            {
+                double a1 = -2 * poles[i].re;
+                double a2 = poles[i].re * poles[i].re +
+                    poles[i].im * poles[i].im;
+                uint32_t j = n++;
+
+                while (j > 0 && cascade.section[j - 1].a[1] > a2)
+                {
+                    cascade.section[j] = cascade.section[j - 1];
+                    j--;
+                }
+
+                cascade.section[j] = {{1, 2, 1}, {float(a1), float(a2)}};
+            }
+        }
+
+        for (uint32_t j = 0; j < 3; j++)
+        {
+            cascade.section[0].b[j] *= gain.re;
+        }
+
+        return cascade;
+    }
+
+protected:
+    static constexpr uint32_t kOrder = 2 * num_sections;
+    static constexpr double kPi = 3.14159265358979323846;
+
+    struct Complex
+    {
+        double re;
+        double im;
+
+        constexpr Complex operator+(Complex b) const
+        {
+            return {re + b.re, im + b.im};
+        }
+
+        constexpr Complex operator-(Complex b) const
+        {
+            return {re - b.re, im - b.im};
+        }
+
+        constexpr Complex operator*(Complex b) const
+        {
+            return {re * b.re - im * b.im, re * b.im + im * b.re};
+        }
+
+        constexpr Complex operator/(Complex b) const
+        {
+            double d = b.re * b.re + b.im * b.im;
+            return {(re * b.re + im * b.im) / d, (im * b.re - re * b.im) / d};
+        }
+    };
+
+    // Valid for |x| <= pi / 4, which covers cutoffs up to a quarter of the
+    // sample rate
+    static constexpr double Tan(double x)
+    {
+        double sine = 0;
+        double cosine = 0;
+        double term = 1;
+
+        for (uint32_t k = 0; k < 20; k++)
+        {
+            // term = x^k / k!
+            if (k % 2)
+            {
+                sine += (k % 4 == 1) ? term : -term;
+            }
+            else
+            {
+                cosine += (k % 4 == 0) ? term : -term;
+            }
+
+            term *= x / (k + 1);
+        }
+
+        return sine / cosine;
+    }
+
+    // Returns the positive nth root of x
+    static constexpr double Root(double x, uint32_t n)
+    {
+        double y = 1;
+
+        for (uint32_t i = 0; i < 200; i++)
+        {
+            double p = 1;
+
+            for (uint32_t j = 0; j < n - 1; j++)
+            {
+                p *= y;
+            }
+
+            y -= (p * y - x) / (n * p);
+        }
+
+        return y;
+    }
+
+    // Find the roots of the reverse Bessel polynomial by the Durand-Kerner
+    // method and normalize them so that the phase response has the same
+    // asymptotes as a Butterworth filter.
+    static constexpr void AnalogPoles(Complex (&poles)[kOrder])
+    {
+        // Coefficients, lowest order first. The polynomial is monic.
+        double a[kOrder + 1] = {};
+        a[kOrder] = 1;
+
+        for (uint32_t k = kOrder; k > 0; k--)
+        {
+            a[k - 1] = a[k] * (2 * kOrder - k + 1) * k /
+                (2 * (kOrder - k + 1));
+        }
+
+        Complex seed = {0.4, 0.9};
+        Complex z = {1, 0};
+
+        for (uint32_t i = 0; i < kOrder; i++)
+        {
+            poles[i] = z;
+            z = z * seed;
+        }
+
+        for (uint32_t iteration = 0; iteration < 500; iteration++)
+        {
+            for (uint32_t i = 0; i < kOrder; i++)
+            {
+                Complex numerator = {a[kOrder], 0};
+                Complex denominator = {1, 0};
+
+                for (uint32_t k = kOrder; k > 0; k--)
+                {
+                    numerator = numerator * poles[i] + Complex{a[k - 1], 0};
+                }
+
+                for (uint32_t j = 0; j < kOrder; j++)
+                {
+                    if (j != i)
+                    {
+                        denominator = denominator * (poles[i] - poles[j]);
+                    }
+                }
+
+                poles[i] = poles[i] - numerator / denominator;
+            }
+        }
+
+        double scale = 1 / Root(a[0], kOrder);
+
+        for (uint32_t i = 0; i < kOrder; i++)
+        {
+            poles[i] = poles[i] * Complex{scale, 0};
+        }
+    }
+};
+
+}
@@ -24,195 +24,160 @@
 #pragma once
 
 #include <cstdint>
+#include "bessel.h"
 #include "util.h"
 
 namespace quadra
 {
 
-template <uint32_t symbol_duration>
+template <uint32_t symbol_duration,
+          typename T = float,
+          uint32_t num_sections = 2>
 class CarrierRejectionFilter
 {
 protected:
-    struct Biquad
-    {
-        float b[3];
-        float a[2];
-    };
+    template <uint32_t, uint32_t, uint32_t, typename, uint32_t>
+    friend class MultiDemodulator;
 
-    /* [[[cog
-    import crf
-
-    filters = list(crf.generate())
-    num_sec = crf.NUM_SECTIONS
-
-    for Tsym, sos in filters:
-        cog.outl('static constexpr Biquad kFilter{0:02}[{1}] ='
-            .format(Tsym, num_sec))
-        cog.outl('{')
-        print_coeff = lambda c: '{: .8e},'.format(c).ljust(17)
-        for sec in sos:
-            cog.outl('    {')
-            b = ''.join([print_coeff(c) for c in sec[:3]])
-            a = ''.join([print_coeff(c) for c in sec[4:]])
-            cog.outl('        {' + b + '},')
-            cog.outl('        {' + a + '},')
-            cog.outl('    },')
-        cog.outl('};')
-
-    cog.outl('')
-
-    cog.outl('static_assert(')
-    for Tsym, _ in filters:
-        cog.outl('    symbol_duration == {0:>2} ||'.format(Tsym))
-    cog.outl('    false, "Unsupported symbol duration");')
-
-    cog.outl('')
-
-    cog.outl('static constexpr const Biquad* kFilter =')
-    for Tsym, _ in filters:
-        cog.outl('    symbol_duration == {0:>2} ? kFilter{0:02} :'.format(Tsym))
-    cog.outl('                            nullptr;')
-
-    cog.outl('')
-
-    cog.outl('static constexpr int32_t kNumSections = {};'.format(num_sec))
-    ]]] */
-    static constexpr Biquad kFilter05[2] =
-    {
-        {
-            { 3.92776413e-02,  7.85552825e-02,  3.92776413e-02, },
-            {-3.79928658e-01,  5.60593774e-02, },
-        },
-        {
-            { 1.00000000e+00,  2.00000000e+00,  1.00000000e+00, },
-            {-3.20574398e-01,  2.50042978e-01, },
-        },
-    };
-    static constexpr Biquad kFilter06[2] =
-    {
-        {
-            { 2.22461678e-02,  4.44923356e-02,  2.22461678e-02, },
-            {-6.00047253e-01,  1.07855334e-01, },
-        },
-        {
-            { 1.00000000e+00,  2.00000000e+00,  1.00000000e+00, },
-            {-5.87365297e-01,  2.88296807e-01, },
-        },
-    };
-    static constexpr Biquad kFilter08[2] =
+    using Vector = ComplexType<T>;
+
+    // Bessel low-pass with a cutoff at the symbol rate, i.e. at the carrier
+    // frequency, so that the double-frequency mixing products are rejected
+    static_assert(num_sections > 0);
+    static_assert(symbol_duration >= 4, "Symbol duration is too short");
+    static constexpr int32_t kNumSections = num_sections;
+    static constexpr auto kFilter =
+        BesselLowpass<num_sections>::Design(1.0 / symbol_duration);
+
+    // Coefficients converted to the sample type at compile time
+    struct Section
     {
-        {
-            { 8.90855348e-03,  1.78171070e-02,  8.90855348e-03, },
-            {-8.90333311e-01,  2.12089103e-01, },
-        },
-        {
-            { 1.00000000e+00,  2.00000000e+00,  1.00000000e+00, },
-            {-9.30043914e-01,  3.73040930e-01, },
-        },
+        T b[3];
+        T a[2];
     };
-    static constexpr Biquad kFilter10[2] =
+
+    struct Cascade
     {
-        {
-            { 4.28742029e-03,  8.57484059e-03,  4.28742029e-03, },
-            {-1.07701239e+00,  3.00943042e-01, },
-        },
-        {
-            { 1.00000000e+00,  2.00000000e+00,  1.00000000e+00, },
-            {-1.14096126e+00,  4.47300396e-01, },
-        },
+        Section section[kNumSections];
     };
-    static constexpr Biquad kFilter12[2] =
+
+    static constexpr Cascade ConvertCoefficients(void)
     {
+        Cascade cascade{};
+
+        for (int32_t i = 0; i < kNumSections; i++)
         {
-            { 2.32292006e-03,  4.64584012e-03,  2.32292006e-03, },
-            {-1.20854549e+00,  3.73931646e-01, },
-        },
-        {
-            { 1.00000000e+00,  2.00000000e+00,  1.00000000e+00, },
-            {-1.28361256e+00,  5.08339473e-01, },
-        },
-    };
-    static constexpr Biquad kFilter16[2] =
+            for (int32_t j = 0; j < 3; j++)
+            {
+                cascade.section[i].b[j] = kFilter.section[i].b[j];
+            }
+
+            for (int32_t j = 0; j < 2; j++)
+            {
+                cascade.section[i].a[j] = kFilter.section[i].a[j];
+            }
+        }
+
+        return cascade;
+    }
+
+    static constexpr Cascade kCascade = ConvertCoefficients();
+
+    // Transposed direct form II state. The I and Q channels are stored as
+    // separate lanes of the innermost dimension so that both can be
+    // computed with the same instructions.
+    static constexpr int32_t kNumLanes = 2;
+    T s_[kNumSections][2][kNumLanes];
+    T out_[kNumLanes];
+
+    static void Filter(const Section& f, T* s0, T* s1, T* x)
     {
+        for (int32_t c = 0; c < kNumLanes; c++)
         {
-            { 8.59253439e-04,  1.71850688e-03,  8.59253439e-04, },
-            {-1.38286746e+00,  4.84047812e-01, },
-        },
-        {
-            { 1.00000000e+00,  2.00000000e+00,  1.00000000e+00, },
-            {-1.46367541e+00,  5.99552135e-01, },
-        },
-    };
-
-    static_assert(
-        symbol_duration ==  5 ||
-        symbol_duration ==  6 ||
-        symbol_duration ==  8 ||
-        symbol_duration == 10 ||
-        symbol_duration == 12 ||
-        symbol_duration == 16 ||
-        false, "Unsupported symbol duration");
-
-    static constexpr const Biquad* kFilter =
-        symbol_duration ==  5 ? kFilter05 :
-        symbol_duration ==  6 ? kFilter06 :
-        symbol_duration ==  8 ? kFilter08 :
-        symbol_duration == 10 ? kFilter10 :
-        symbol_duration == 12 ? kFilter12 :
-        symbol_duration == 16 ? kFilter16 :
-                                nullptr;
-
-    static constexpr int32_t kNumSections = 2;
-    // [[[end]]]
-
-    Vector x_[kNumSections][3];
-    Vector y_[kNumSections][2];
+            T y = f.b[0] * x[c] + s0[c];
+            s0[c] = f.b[1] * x[c] - f.a[0] * y + s1[c];
+            s1[c] = f.b[2] * x[c] - f.a[1] * y;
+            x[c] = y;
+        }
+    }
 
 public:
     void Init(void)
     {
         for (int32_t i = 0; i < kNumSections; i++)
         {
-            x_[i][0] = 0;
-            x_[i][1] = 0;
-            x_[i][2] = 0;
-            y_[i][0] = 0;
-            y_[i][1] = 0;
+            for (int32_t c = 0; c < kNumLanes; c++)
+            {
+                s_[i][0][c] = 0;
+                s_[i][1][c] = 0;
+            }
         }
+
+        out_[0] = 0;
+        out_[1] = 0;
     }
 
     Vector Process(Vector in)
     {
+        T x[kNumLanes] = {in.real(), in.imag()};
+
         for (int32_t i = 0; i < kNumSections; i++)
         {
-            // Shift x state
-            x_[i][2] = x_[i][1];
-            x_[i][1] = x_[i][0];
-            x_[i][0] = in;
-
-            Vector out = 0;
-
-            // Add x state
-            out += kFilter[i].b[0] * x_[i][0];
-            out += kFilter[i].b[1] * x_[i][1];
-            out += kFilter[i].b[2] * x_[i][2];
-
-            // Subtract y state
-            out -= kFilter[i].a[0] * y_[i][0];
-            out -= kFilter[i].a[1] * y_[i][1];
-
-            // Shift y state
-            y_[i][1] = y_[i][0];
-            y_[i][0] = out;
-            in = out;
+            Filter(kCascade.section[i], s_[i][0], s_[i][1], x);
         }
 
+        out_[0] = x[0];
+        out_[1] = x[1];
         return output();
     }
 
+    // Filter a whole buffer at once. The filter state is held in locals for
+    // the duration of the loop so that it can stay in registers. The input
+    // and output buffers may be the same.
+    void Process(const Vector* in, Vector* out, uint32_t length)
+    {
+        T s[kNumSections][2][kNumLanes];
+
+        for (int32_t i = 0; i < kNumSections; i++)
+        {
+            for (int32_t c = 0; c < kNumLanes; c++)
+            {
+                s[i][0][c] = s_[i][0][c];
+                s[i][1][c] = s_[i][1][c];
+            }
+        }
+
+        T x[kNumLanes] = {out_[0], out_[1]};
+
+        for (uint32_t n = 0; n < length; n++)
+        {
+            x[0] = in[n].real();
+            x[1] = in[n].imag();
+
+            for (int32_t i = 0; i < kNumSections; i++)
+            {
+                Filter(kCascade.section[i], s[i][0], s[i][1], x);
+            }
+
+            out[n] = {x[0], x[1]};
+        }
+
+        for (int32_t i = 0; i < kNumSections; i++)
+        {
+            for (int32_t c = 0; c < kNumLanes; c++)
+            {
+                s_[i][0][c] = s[i][0][c];
+                s_[i][1][c] = s[i][1][c];
+            }
+        }
+
+        out_[0] = x[0];
+        out_[1] = x[1];
+    }
+
     Vector output(void)
     {
-        return y_[kNumSections - 1][0];
+        return {out_[0], out_[1]};
     }
 };
 
@@ -31,25 +31,28 @@
 namespace quadra
 {
 
+template <typename T = float>
 class Correlator
 {
 protected:
+    using Vector = ComplexType<T>;
+
     static constexpr uint32_t kPatternLength = 8;
-    static constexpr float kAlignmentPattern[2][kPatternLength] =
+    static constexpr T kAlignmentPattern[2][kPatternLength] =
     {
         { -1, -1, -1,  0,  1,  1,  1,  0},
         { -1,  0,  1,  1,  1,  0, -1, -1},
     };
 
-    static constexpr float kPeakThreshold = kPatternLength / 2.0;
+    static constexpr T kPeakThreshold = kPatternLength / 2.0;
     static constexpr uint32_t kNumCorrelationPeaks = 4;
 
     Window<Vector, kPatternLength> v_history_;
-    Window<float, 3> phase_history_;
-    Window<float, 3> correlation_history_;
-    float maximum_;
+    Window<T, 3> phase_history_;
+    Window<T, 3> correlation_history_;
+    T maximum_;
     uint32_t correlation_peaks_;
-    Window<float, kNumCorrelationPeaks> decision_vector_;
+    Window<T, kNumCorrelationPeaks> decision_vector_;
 
 public:
     void Init(void)
@@ -67,22 +70,22 @@ public:
         decision_vector_.Init();
     }
 
-    void Push(float phase, Vector v)
+    void Push(T phase, Vector v)
     {
         phase_history_.Write(phase);
         v_history_.Write(v);
     }
 
-    std::optional<float> Process(float phase, Vector v)
+    std::optional<T> Process(T phase, Vector v)
     {
         Push(phase, v);
 
-        float correlation = 0;
+        T correlation = 0;
 
         for (uint32_t i = 0; i < kPatternLength; i++)
         {
-            float expected_i = kAlignmentPattern[0][i];
-            float expected_q = kAlignmentPattern[1][i];
+            T expected_i = kAlignmentPattern[0][i];
+            T expected_q = kAlignmentPattern[1][i];
             correlation += expected_i * v_history_[i].real();
             correlation += expected_q * v_history_[i].imag();
         }
@@ -111,14 +114,14 @@ public:
             // We can approximate the sub-sample position of the peak by
             // comparing the relative correlation of the samples before and
             // after the raw peak.
-            float left = correlation_history_[1] - correlation_history_[2];
-            float right = correlation_history_[1] - correlation_history_[0];
-            float tilt = 0.5 * (left - right) / (left + right);
+            T left = correlation_history_[1] - correlation_history_[2];
+            T right = correlation_history_[1] - correlation_history_[0];
+            T tilt = T(0.5) * (left - right) / (left + right);
 
-            float a = phase_history_[1];
-            float b = phase_history_[(tilt < 0) ? 2 : 0];
-            float t = Abs(tilt);
-            float phase_i = Lerp(Cosine(a), Cosine(b), t);
+            T a = phase_history_[1];
+            T b = phase_history_[(tilt < 0) ? 2 : 0];
+            T t = Abs(tilt);
+            T phase_i = Lerp(Cosine(a), Cosine(b), t);
 
             // We're trying to resolve a 180-degree phase ambiguity, so we only
             // need to look at the in-phase (real) component to determine
@@ -129,14 +132,14 @@ public:
             if (++correlation_peaks_ == kNumCorrelationPeaks)
             {
                 // Quantize decision phase to 0 or 0.5
-                return (decision_vector_.sum() > 0) ? 0 : 0.5;
+                return T((decision_vector_.sum() > 0) ? 0 : 0.5);
             }
         }
 
         return std::nullopt;
     }
 
-    float output(void)
+    T output(void)
     {
         return correlation_history_[0];
     }
@@ -23,18 +23,117 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
+
+#if defined(__ARM_FEATURE_CRC32)
+    #include <arm_acle.h>
+#endif
+
+#if defined(__PCLMUL__) && defined(__SSE4_1__)
+    #include <immintrin.h>
+#endif
 
 namespace quadra
 {
 
-class Crc32
+// Arithmetic modulo the CRC-32 polynomial, in the same reflected bit order
+// as the CRC register. Since the CRC is linear, this allows us to find the
+// effect of a change to a message on its CRC without reprocessing the
+// message. See also zlib's crc32_combine.
+class Crc32Polynomial
 {
-protected:
+public:
     static constexpr uint32_t kPolynomial = 0xEDB88320;
 
-    static inline bool initialized_;
-    static inline uint32_t table_[256];
-    uint32_t crc_;
+    // Returns x^n modulo the polynomial
+    static uint32_t Power(uint32_t n)
+    {
+        uint32_t p = kOne;
+
+        for (uint32_t k = 0; n; k++, n >>= 1)
+        {
+            if (n & 1)
+            {
+                p = Multiply(kPowers.x2n[k], p);
+            }
+        }
+
+        return p;
+    }
+
+    // Returns the change in the CRC of a message of the given length in
+    // bytes that results from flipping the given bit. Bits are numbered
+    // from the LSB of the first byte.
+    static uint32_t BitFlip(uint32_t bit_pos, uint32_t length)
+    {
+        return Power(length * 8 - 1 - bit_pos + 32);
+    }
+
+protected:
+    static constexpr uint32_t kOne = 0x80000000;
+
+    static constexpr uint32_t Multiply(uint32_t a, uint32_t b)
+    {
+        uint32_t product = 0;
+
+        for (uint32_t m = kOne; m; m >>= 1)
+        {
+            if (a & m)
+            {
+                product ^= b;
+            }
+
+            b = (b & 1) ? ((b >> 1) ^ kPolynomial) : (b >> 1);
+        }
+
+        return product;
+    }
+
+    struct Powers
+    {
+        uint32_t x2n[32];
+    };
+
+    // x^(2^k) for each k
+    static constexpr Powers ComputePowers(void)
+    {
+        Powers powers{};
+        powers.x2n[0] = kOne >> 1;
+
+        for (uint32_t k = 1; k < 32; k++)
+        {
+            powers.x2n[k] = Multiply(powers.x2n[k - 1], powers.x2n[k - 1]);
+        }
+
+        return powers;
+    }
+
+    static const Powers kPowers;
+};
+
+inline constexpr Crc32Polynomial::Powers Crc32Polynomial::kPowers =
+    Crc32Polynomial::ComputePowers();
+
+// CRC-32 engines. All engines compute the same CRC as zlib's crc32 and
+// share the same interface, so any of them (or a user-supplied engine, e.g.
+// one backed by a CRC peripheral) may be passed to Packet and Decoder.
+
+// Software CRC-32 using num_slices lookup tables, which are computed at
+// compile time and placed in read-only memory. Each table occupies 1KB.
+// With 4 or 8 tables, that many bytes are processed per step.
+template <uint32_t num_slices = 1>
+class SoftwareCrc32
+{
+protected:
+    static_assert(num_slices == 1 || num_slices == 4 || num_slices == 8,
+        "Unsupported number of slices");
+
+    static constexpr uint32_t kPolynomial = Crc32Polynomial::kPolynomial;
+
+    struct Table
+    {
+        uint32_t entry[num_slices][256];
+    };
 
     static constexpr uint32_t ComputeTableEntry(uint32_t x)
     {
@@ -54,19 +153,79 @@ protected:
         return x;
     }
 
-public:
-    void Init(void)
+    static constexpr Table ComputeTable(void)
     {
-        if (!initialized_)
+        Table table{};
+
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            table.entry[0][i] = ComputeTableEntry(i);
+        }
+
+        // Each subsequent table advances the CRC by one more zero byte
+        for (uint32_t s = 1; s < num_slices; s++)
         {
             for (uint32_t i = 0; i < 256; i++)
             {
-                table_[i] = ComputeTableEntry(i);
+                uint32_t prev = table.entry[s - 1][i];
+                table.entry[s][i] = (prev >> 8) ^ table.entry[0][prev & 0xFF];
+            }
+        }
+
+        return table;
+    }
+
+    static constexpr Table kTable = ComputeTable();
+
+    uint32_t crc_;
+
+    static uint32_t Load32(const uint8_t* data)
+    {
+        return (data[0] <<  0) | (data[1] <<  8) |
+               (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    }
+
+    static uint32_t Update(uint32_t crc, const uint8_t* data, uint32_t length)
+    {
+        if constexpr (num_slices > 1)
+        {
+            for (; length >= num_slices; length -= num_slices)
+            {
+                uint32_t next = 0;
+
+                for (uint32_t w = 0; w < num_slices / 4; w++)
+                {
+                    uint32_t word = Load32(data);
+                    data += 4;
+
+                    if (w == 0)
+                    {
+                        word ^= crc;
+                    }
+
+                    for (uint32_t b = 0; b < 4; b++)
+                    {
+                        uint32_t slice = num_slices - 1 - (w * 4 + b);
+                        next ^= kTable.entry[slice][(word >> (8 * b)) & 0xFF];
+                    }
+                }
+
+                crc = next;
             }
+        }
 
-            initialized_ = true;
+        while (length--)
+        {
+            uint8_t byte = *(data++);
+            crc = (crc >> 8) ^ kTable.entry[0][(crc & 0xFF) ^ byte];
         }
 
+        return crc;
+    }
+
+public:
+    void Init(void)
+    {
         crc_ = 0xFFFFFFFF;
     }
 
@@ -77,19 +236,149 @@ public:
 
     uint32_t Process(const uint8_t* data, uint32_t length)
     {
+        crc_ = Update(crc_, data, length);
+        return ~crc_;
+    }
+
+    uint32_t crc(void) const
+    {
+        return ~crc_;
+    }
+};
+
+#if defined(__ARM_FEATURE_CRC32)
+
+// CRC-32 using the ARMv8 CRC32 instructions
+class Armv8Crc32 : public SoftwareCrc32<1>
+{
+public:
+    uint32_t Process(const uint8_t* data, uint32_t length)
+    {
+        uint32_t crc = crc_;
+
+        for (; length >= 4; length -= 4)
+        {
+            uint32_t word;
+            std::memcpy(&word, data, 4);
+            #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                word = __builtin_bswap32(word);
+            #endif
+            crc = __crc32w(crc, word);
+            data += 4;
+        }
+
         while (length--)
         {
-            uint8_t byte = *(data++);
-            crc_ = (crc_ >> 8) ^ table_[(crc_ & 0xFF) ^ byte];
+            crc = __crc32b(crc, *(data++));
         }
 
+        crc_ = crc;
         return ~crc_;
     }
+};
 
-    uint32_t crc(void) const
+#endif
+
+#if defined(__PCLMUL__) && defined(__SSE4_1__)
+
+// CRC-32 using carry-less multiplication to fold 64 bytes at a time, as
+// described in "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+// Instruction" by Vinodh Gopal et al. (Intel, 2009). Short inputs and
+// leftover bytes fall back to the table.
+class PclmulCrc32 : public SoftwareCrc32<1>
+{
+protected:
+    static uint32_t Fold(uint32_t crc, const uint8_t* data, uint32_t length)
+    {
+        // Bit-reflected folding constants and Barrett reduction constants
+        const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+        const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+        const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+        const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+        const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+
+        auto load = [](const uint8_t* p)
+        {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        };
+
+        auto fold = [](__m128i x, __m128i k, __m128i next)
+        {
+            __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+            __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+            return _mm_xor_si128(_mm_xor_si128(hi, lo), next);
+        };
+
+        __m128i x1 = _mm_xor_si128(load(data), _mm_cvtsi32_si128(crc));
+        __m128i x2 = load(data + 16);
+        __m128i x3 = load(data + 32);
+        __m128i x4 = load(data + 48);
+        data += 64;
+        length -= 64;
+
+        for (; length >= 64; length -= 64)
+        {
+            x1 = fold(x1, k1k2, load(data));
+            x2 = fold(x2, k1k2, load(data + 16));
+            x3 = fold(x3, k1k2, load(data + 32));
+            x4 = fold(x4, k1k2, load(data + 48));
+            data += 64;
+        }
+
+        x1 = fold(x1, k3k4, x2);
+        x1 = fold(x1, k3k4, x3);
+        x1 = fold(x1, k3k4, x4);
+
+        for (; length >= 16; length -= 16)
+        {
+            x1 = fold(x1, k3k4, load(data));
+            data += 16;
+        }
+
+        // Fold 128 bits to 64 bits
+        __m128i x2r = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+        x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2r);
+        x2r = _mm_srli_si128(x1, 4);
+        x1 = _mm_and_si128(x1, mask);
+        x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+        x1 = _mm_xor_si128(x1, x2r);
+
+        // Barrett reduction to 32 bits
+        x2r = _mm_and_si128(x1, mask);
+        x2r = _mm_clmulepi64_si128(x2r, poly, 0x10);
+        x2r = _mm_and_si128(x2r, mask);
+        x2r = _mm_clmulepi64_si128(x2r, poly, 0x00);
+        x1 = _mm_xor_si128(x1, x2r);
+
+        return _mm_extract_epi32(x1, 1);
+    }
+
+public:
+    uint32_t Process(const uint8_t* data, uint32_t length)
     {
+        if (length >= 64)
+        {
+            uint32_t bulk = length & ~15u;
+            crc_ = Fold(crc_, data, bulk);
+            data += bulk;
+            length -= bulk;
+        }
+
+        crc_ = Update(crc_, data, length);
         return ~crc_;
     }
 };
 
+#endif
+
+// The default engine is the fastest one available for the target without
+// requiring additional program memory.
+#if defined(__ARM_FEATURE_CRC32)
+    using Crc32 = Armv8Crc32;
+#elif defined(__PCLMUL__) && defined(__SSE4_1__)
+    using Crc32 = PclmulCrc32;
+#else
+    using Crc32 = SoftwareCrc32<1>;
+#endif
+
 }
@@ -1,3 +1,6 @@
+# Reference design and response plots for the carrier rejection filter. The
+# decoder designs the same filters at compile time (see bessel.h).
+
 import scipy.signal as signal
 
 NUM_SECTIONS = 2
@@ -8,7 +11,7 @@ def gen_filter(Tsymbol):
     return signal.bessel(N, wc, output='sos', fs=1)
 
 def generate():
-    for Tsym in (5, 6, 8, 10, 12, 16):
+    for Tsym in range(4, 17):
         yield Tsym, gen_filter(Tsym)
 
 if __name__ == '__main__':
@@ -41,7 +41,7 @@ protected:
     }
 
 public:
-    void Init(T value = 0)
+    void Init(T value = T(0))
     {
         for (uint32_t i = 0; i < size; i++)
         {
@@ -29,22 +29,35 @@
 #include "correlator.h"
 #include "one_pole.h"
 #include "pll.h"
+#include "profiler.h"
+#include "resampler.h"
 #include "util.h"
 #include "window.h"
 
 namespace quadra
 {
 
-template <uint32_t sample_rate, uint32_t symbol_rate>
+template <uint32_t sample_rate,
+          uint32_t symbol_rate,
+          typename T = float,
+          uint32_t bits_per_symbol = 4,
+          typename Profiler = NullProfiler>
 class Demodulator
 {
 public:
     void Init(void)
+    {
+        profiler_.Init();
+        Reset();
+    }
+
+    // Resets the demodulator's state, but not the profiler's measurements
+    void Reset(void)
     {
         state_ = STATE_WAIT_TO_SETTLE;
 
-        hpf_.Init(0.001);
-        follower_.Init(0.0001);
+        hpf_.Init(kHighpassFrequency);
+        follower_.Init(kFollowerFrequency);
         agc_gain_ = 1;
 
         pll_.Init(1.0 / kSymbolDuration);
@@ -54,16 +67,13 @@ public:
 
         v_history_.Init();
 
-        decision_phase_ = 0;
+        SetDecisionPhase(0);
         skipped_samples_ = 0;
         carrier_sync_count_ = 0;
 
         decide_ = false;
-    }
 
-    void Reset(void)
-    {
-        Init();
+        resampler_.Init();
     }
 
     void BeginCarrierSync(void)
@@ -72,15 +82,144 @@ public:
         carrier_sync_count_ = 0;
     }
 
-    bool Process(uint8_t& symbol, float sample)
+    bool Process(uint8_t& symbol, T sample)
+    {
+        if constexpr (kResample)
+        {
+            T resampled[kMaxResampled];
+            uint32_t n = resampler_.Process(sample, resampled);
+            bool symbol_valid = false;
+
+            for (uint32_t i = 0; i < n; i++)
+            {
+                // No more than one symbol can result from one input sample
+                uint8_t s;
+
+                if (ProcessSample(s, resampled[i]))
+                {
+                    symbol = s;
+                    symbol_valid = true;
+                }
+            }
+
+            return symbol_valid;
+        }
+        else
+        {
+            return ProcessSample(symbol, sample);
+        }
+    }
+
+    // Process samples from the buffer until a symbol is decoded, an error
+    // occurs, or the buffer is exhausted. Returns true if a symbol was
+    // decoded, and sets consumed to the number of samples processed.
+    bool Process(uint8_t& symbol, const T* buffer, uint32_t length,
+        uint32_t& consumed)
+    {
+        uint32_t i = 0;
+        bool symbol_valid = false;
+
+        while (i < length && !symbol_valid && state_ != STATE_ERROR)
+        {
+            if (!kResample && state_ == STATE_OK)
+            {
+                // Steady-state fast path which bypasses the acquisition
+                // state machine.
+                while (i < length && !symbol_valid)
+                {
+                    profiler_.Begin();
+                    T sample = hpf_.Process(buffer[i++]);
+                    follower_.Process(Abs(sample));
+
+                    if (signal_power() < kLevelThreshold)
+                    {
+                        // Close the window as ProcessSample would
+                        profiler_.End(PROFILE_SAMPLE);
+                        state_ = STATE_ERROR;
+                        break;
+                    }
+
+                    sample *= agc_gain_;
+                    profiler_.Lap(PROFILE_FRONT_END);
+                    symbol_valid = Track(symbol, sample);
+                    profiler_.End(PROFILE_SAMPLE);
+                }
+            }
+            else
+            {
+                symbol_valid = Process(symbol, buffer[i++]);
+            }
+        }
+
+        consumed = i;
+        return symbol_valid;
+    }
+
+    bool error(void)
     {
+        return state_ == STATE_ERROR;
+    }
+
+    Profiler& profiler(void)
+    {
+        return profiler_;
+    }
+
+    // Accessors for debug and simulation
+    uint32_t state(void)          {return state_;}
+    T    pll_phase(void)      {return pll_.phase();}
+    T    pll_error(void)      {return pll_.error();}
+    T    pll_step(void)       {return pll_.step();}
+    T    decision_phase(void) {return decision_phase_;}
+    T    signal_power(void)   {return follower_.output();}
+    T    recovered_i(void)    {return crf_.output().real();}
+    T    recovered_q(void)    {return crf_.output().imag();}
+    T    correlation(void)    {return correlator_.output();}
+    bool     decide(void)         {return decide_;}
+    T    agc(void)            {return agc_gain_;}
+
+protected:
+    // Shares the constants and helpers below
+    template <uint32_t, uint32_t, uint32_t, typename, uint32_t>
+    friend class MultiDemodulator;
+
+    using Vector = ComplexType<T>;
+
+    // If the sample rate isn't an integer multiple of the symbol rate, the
+    // input is resampled to the next higher one. The resampler's passband
+    // isn't flat enough to land on 4 samples per symbol, so that ratio is
+    // only accepted when it is exact.
+    static_assert(sample_rate >= 4 * symbol_rate,
+        "Sample rate must be at least 4 times the symbol rate");
+    static_assert(sample_rate % symbol_rate == 0 ||
+        sample_rate >= 5 * symbol_rate,
+        "Sample rate must be an exact multiple of the symbol rate, "
+        "or at least 5 times it");
+    static_assert(sample_rate <= 16 * symbol_rate,
+        "Sample rate must be at most 16 times the symbol rate");
+    static constexpr uint32_t kSymbolDuration =
+        (sample_rate + symbol_rate - 1) / symbol_rate;
+    static constexpr uint32_t kInternalRate = symbol_rate * kSymbolDuration;
+    static constexpr bool kResample = (kInternalRate != sample_rate);
+    using InputResampler = Resampler<sample_rate, kInternalRate, T>;
+    static constexpr uint32_t kMaxResampled = InputResampler::kMaxOutputs;
+
+    // At 4 samples per symbol, a second filter section adds more group delay
+    // ripple than the symbol decisions can tolerate.
+    static constexpr uint32_t kFilterSections = (kSymbolDuration > 4) ? 2 : 1;
+
+    bool ProcessSample(uint8_t& symbol, T sample)
+    {
+        profiler_.Begin();
         sample = hpf_.Process(sample);
 
-        float env = Abs(sample);
+        T env = Abs(sample);
 
         follower_.Process(env);
-        float level = signal_power();
+        T level = signal_power();
         sample *= agc_gain_;
+        profiler_.Lap(PROFILE_FRONT_END);
+        bool symbol_valid = false;
 
         if (state_ == STATE_WAIT_TO_SETTLE)
         {
@@ -102,9 +241,7 @@ public:
             }
             else if (level > kLevelThreshold)
             {
-                constexpr float kTwoOverPi = 0.64;
-                constexpr float kSqrt2 = 1.41;
-                agc_gain_ = kTwoOverPi / level * kIQAmplitude * kSqrt2;
+                agc_gain_ = InitialGain(level);
                 BeginCarrierSync();
             }
             else
@@ -120,37 +257,19 @@ public:
             }
             else
             {
-                return Demodulate(symbol, sample);
+                symbol_valid = Demodulate(symbol, sample);
             }
         }
 
-        return false;
-    }
-
-    bool error(void)
-    {
-        return state_ == STATE_ERROR;
+        profiler_.End(PROFILE_SAMPLE);
+        return symbol_valid;
     }
 
-    // Accessors for debug and simulation
-    uint32_t state(void)          {return state_;}
-    float    pll_phase(void)      {return pll_.phase();}
-    float    pll_error(void)      {return pll_.error();}
-    float    pll_step(void)       {return pll_.step();}
-    float    decision_phase(void) {return decision_phase_;}
-    float    signal_power(void)   {return follower_.output();}
-    float    recovered_i(void)    {return crf_.output().real();}
-    float    recovered_q(void)    {return crf_.output().imag();}
-    float    correlation(void)    {return correlator_.output();}
-    bool     decide(void)         {return decide_;}
-    float    agc(void)            {return agc_gain_;}
-
-protected:
-    static constexpr uint32_t kSettlingTime = sample_rate * 0.25;
-    static constexpr float kLevelThreshold = 0.05;
+    static constexpr float kHighpassFrequency = 0.001;
+    static constexpr float kFollowerFrequency = 0.0001;
+    static constexpr uint32_t kSettlingTime = kInternalRate * 0.25;
+    static constexpr T kLevelThreshold = 0.05;
     static constexpr uint32_t kCarrierSyncLength = symbol_rate * 0.025;
-    static_assert(sample_rate % symbol_rate == 0);
-    static constexpr uint32_t kSymbolDuration = sample_rate / symbol_rate;
 
     enum State
     {
@@ -165,49 +284,123 @@ protected:
 
     State state_;
 
-    OnePoleHighpass hpf_;
-    OnePoleLowpass follower_;
-    float agc_gain_;
+    OnePoleHighpass<T> hpf_;
+    OnePoleLowpass<T> follower_;
+    T agc_gain_;
 
-    PhaseLockedLoop pll_;
-    CarrierRejectionFilter<kSymbolDuration> crf_;
+    PhaseLockedLoop<T> pll_;
+    CarrierRejectionFilter<kSymbolDuration, T, kFilterSections> crf_;
 
-    Correlator correlator_;
+    Correlator<T> correlator_;
+    InputResampler resampler_;
     Window<Vector, kSymbolDuration> v_history_;
 
-    float decision_phase_;
+    T decision_phase_;
+    T decision_cos_;
+    T decision_sin_;
     uint32_t skipped_samples_;
     uint32_t carrier_sync_count_;
 
     bool decide_;
 
-    static constexpr float kAGCSlow = 50e-6;
-    static constexpr float kAGCFast = 1e-3;
+    Profiler profiler_;
+
+    // Gain which normalizes the mean rectified level of the carrier sync
+    // signal to the constellation
+    static T InitialGain(T level)
+    {
+        constexpr T kTwoOverPi = 0.64;
+        constexpr T kSqrt2 = 1.41;
+        return kTwoOverPi / level * kIQAmplitude * kSqrt2;
+    }
+
+    static constexpr T kAGCSlow = 50e-6;
+    static constexpr T kAGCFast = 1e-3;
 
-    void AGCProcess(Vector v, Vector v_bar, float speed)
+    void AGCProcess(Vector v, Vector v_bar, T speed)
     {
-        float i = v.real();
-        float q = v.imag();
-        float i_bar = v_bar.real();
-        float q_bar = v_bar.imag();
-        float error = (i * i + q * q) - (i_bar * i_bar + q_bar * q_bar);
+        T i = v.real();
+        T q = v.imag();
+        T i_bar = v_bar.real();
+        T q_bar = v_bar.imag();
+        T error = (i * i + q * q) - (i_bar * i_bar + q_bar * q_bar);
         agc_gain_ -= speed * error;
     }
 
-    bool Demodulate(uint8_t& symbol, float sample)
+    void SetDecisionPhase(T phase)
     {
-        float phi = pll_.phase();
-        Vector osc{Cosine(phi), -Sine(phi)};
-        Vector v = crf_.Process(2 * sample * osc);
+        decision_phase_ = phase;
+        SinCos(phase, decision_sin_, decision_cos_);
+    }
+
+    // Demodulation in the STATE_OK state, i.e. after carrier lock and
+    // alignment have been achieved.
+    bool Track(uint8_t& symbol, T sample)
+    {
+        // The oscillator is driven directly by the PLL phase, so it follows
+        // every change to the step without accumulating error of its own
+        T phi = pll_.phase();
+        T sin_phi;
+        T cos_phi;
+        SinCos(phi, sin_phi, cos_phi);
+        Vector osc{cos_phi, -sin_phi};
+        Vector x = 2 * sample * osc;
+        profiler_.Lap(PROFILE_MIXER);
+        Vector v = crf_.Process(x);
+        profiler_.Lap(PROFILE_CRF);
         Vector v_bar = Quantize(v);
         v_history_.Write(v);
         decide_ = false;
         bool symbol_valid = false;
 
+        T phase_error = CrossProduct(v, v_bar);
+        // Raised-cosine weighting to reject noisy error between symbols. The
+        // cosine of the phase difference follows from the oscillator output.
+        T cos_delta = cos_phi * decision_cos_ + sin_phi * decision_sin_;
+        phase_error *= T(0.5) * (1 + cos_delta);
+        pll_.ProcessError(phase_error);
+        auto decision = pll_.phase_trigger(decision_phase_);
+        profiler_.Lap(PROFILE_PHASE_DETECTOR);
+
+        if (decision.has_value())
+        {
+            decide_ = true;
+            symbol = DecideSymbol(*decision);
+            symbol_valid = true;
+            AGCProcess(v, v_bar, kAGCSlow);
+            profiler_.Lap(PROFILE_DECISION);
+        }
+
+        pll_.Step();
+        profiler_.Lap(PROFILE_PLL);
+        return symbol_valid;
+    }
+
+    bool Demodulate(uint8_t& symbol, T sample)
+    {
+        if (state_ == STATE_OK)
+        {
+            return Track(symbol, sample);
+        }
+
+        T phi = pll_.phase();
+        T sin_phi;
+        T cos_phi;
+        SinCos(phi, sin_phi, cos_phi);
+        Vector osc{cos_phi, -sin_phi};
+        Vector x = 2 * sample * osc;
+        profiler_.Lap(PROFILE_MIXER);
+        Vector v = crf_.Process(x);
+        profiler_.Lap(PROFILE_CRF);
+        Vector v_bar = Quantize(v);
+        v_history_.Write(v);
+        decide_ = false;
+
         if (state_ == STATE_CARRIER_SYNC)
         {
             pll_.ProcessError(CrossProduct(v, kCarrierSyncVector));
             auto decision = pll_.phase_trigger(0);
+            profiler_.Lap(PROFILE_PHASE_DETECTOR);
 
             if (decision.has_value())
             {
@@ -228,6 +421,8 @@ protected:
                 {
                     carrier_sync_count_ = 0;
                 }
+
+                profiler_.Lap(PROFILE_DECISION);
             }
         }
         else if (state_ == STATE_CARRIER_LOCK)
@@ -235,20 +430,23 @@ protected:
             pll_.ProcessError(CrossProduct(v, v_bar));
             auto decision0 = pll_.phase_trigger(0);
             auto decision1 = pll_.phase_trigger(0.5);
+            profiler_.Lap(PROFILE_PHASE_DETECTOR);
 
             if (decision0.has_value() || decision1.has_value())
             {
                 decide_ = true;
-                float decision = decision0.value_or(*decision1);
+                T decision = decision0.value_or(*decision1);
                 symbol = DecideSymbol(decision);
 
                 AGCProcess(v, kCarrierSyncVector, kAGCFast);
+                profiler_.Lap(PROFILE_DECISION);
                 correlator_.Push(phi, v);
+                profiler_.Lap(PROFILE_CORRELATOR);
 
                 if (symbol != kCarrierSyncSymbol)
                 {
                     state_ = STATE_ALIGN;
-                    decision_phase_ = 0;
+                    SetDecisionPhase(0);
                 }
             }
         }
@@ -257,95 +455,141 @@ protected:
             pll_.ProcessError(CrossProduct(v, v_bar));
             auto decision0 = pll_.phase_trigger(0);
             auto decision1 = pll_.phase_trigger(0.5);
+            profiler_.Lap(PROFILE_PHASE_DETECTOR);
 
             if (decision0.has_value() || decision1.has_value())
             {
                 decide_ = true;
-                float decision = decision0.value_or(*decision1);
+                T decision = decision0.value_or(*decision1);
                 v = SampleSymbol(decision);
+                profiler_.Lap(PROFILE_DECISION);
                 auto decision_phase = correlator_.Process(phi, v);
+                profiler_.Lap(PROFILE_CORRELATOR);
 
                 if (decision_phase.has_value())
                 {
-                    decision_phase_ = *decision_phase;
+                    SetDecisionPhase(*decision_phase);
                     state_ = STATE_OK;
                 }
             }
         }
-        else if (state_ == STATE_OK)
-        {
-            float phase_error = CrossProduct(v, v_bar);
-            // Raised-cosine weighting to reject noisy error between symbols
-            phase_error *= 0.5 * (1 + Cosine(phi - decision_phase_));
-            pll_.ProcessError(phase_error);
-            auto decision = pll_.phase_trigger(decision_phase_);
-
-            if (decision.has_value())
-            {
-                decide_ = true;
-                symbol = DecideSymbol(*decision);
-                symbol_valid = true;
-                AGCProcess(v, v_bar, kAGCSlow);
-            }
-        }
 
         pll_.Step();
-        return symbol_valid;
+        profiler_.Lap(PROFILE_PLL);
+        return false;
     }
 
-    static constexpr uint32_t kNumQuanta = 4;
-    static constexpr float kIQAmplitude = 1 - 1.0 / kNumQuanta;
+    // The constellation is square, with kNumQuanta levels on each axis. The
+    // carrier sync symbol is the (-, -) corner.
+    static_assert(bits_per_symbol == 2 || bits_per_symbol == 4 ||
+        bits_per_symbol == 6, "Only 4-, 16-, and 64-QAM are supported");
+    static constexpr uint32_t kBitsPerAxis = bits_per_symbol / 2;
+    static constexpr uint32_t kNumQuanta = 1 << kBitsPerAxis;
+    static constexpr T kIQAmplitude = 1 - 1.0 / kNumQuanta;
     static constexpr Vector kCarrierSyncVector{-kIQAmplitude, -kIQAmplitude};
-    static constexpr uint8_t kCarrierSyncSymbol = 0xF;
 
-    int32_t DecisionIndex(float sample)
+    struct Levels
+    {
+        T level[kNumQuanta];
+    };
+
+    static constexpr Levels ComputeLevels(void)
+    {
+        Levels levels{};
+
+        for (uint32_t i = 0; i < kNumQuanta; i++)
+        {
+            levels.level[i] =
+                (1 - 1.0 / kNumQuanta) * (2.0 * i / (kNumQuanta - 1) - 1);
+        }
+
+        return levels;
+    }
+
+    static constexpr Levels kLevels = ComputeLevels();
+
+    static int32_t DecisionIndex(T sample)
     {
-        sample = (kNumQuanta / 2.0) * (sample + 1);
-        return Clamp<int32_t>(sample, 0, kNumQuanta - 1);
+        sample = T(kNumQuanta / 2.0) * (sample + 1);
+        return Clamp<int32_t>(static_cast<int32_t>(sample), 0, kNumQuanta - 1);
     }
 
-    float Quantize(float sample)
+    static T Quantize(T sample)
     {
-        int32_t index = DecisionIndex(sample);
-        return kIQAmplitude * (2.0 * index / (kNumQuanta - 1) - 1);
+        return kLevels.level[DecisionIndex(sample)];
     }
 
-    Vector Quantize(Vector v)
+    static Vector Quantize(Vector v)
     {
         return {Quantize(v.real()), Quantize(v.imag())};
     }
 
-    float CrossProduct(Vector v1, Vector v2)
+    static T CrossProduct(Vector v1, Vector v2)
     {
         return v1.real() * v2.imag() - v2.real() * v1.imag();
     }
 
-    Vector SampleSymbol(float fractional_delay)
+    Vector SampleSymbol(T fractional_delay)
     {
         fractional_delay =
-            Clamp<float>(fractional_delay, 0, kSymbolDuration - 1.001);
-        int32_t i_late = fractional_delay;
+            Clamp<T>(fractional_delay, 0, kSymbolDuration - 1.001);
+        int32_t i_late = static_cast<int32_t>(fractional_delay);
         int32_t i_early = i_late + 1;
         Vector early = v_history_[i_early];
         Vector late = v_history_[i_late];
         return Lerp(late, early, FractionalPart(fractional_delay));
     }
 
-    uint8_t DecideSymbol(float fractional_delay = 0)
+    // Each axis is Gray coded in sign-magnitude form. The sign bits of I and
+    // Q are the two most significant bits of the symbol, followed by the
+    // Gray-coded magnitudes of Q and then I. For 16-QAM, this gives the
+    // same mapping as the original hard-coded table.
+    struct SymbolTable
     {
-        Vector v = SampleSymbol(fractional_delay);
-        int32_t i_index = DecisionIndex(v.real());
-        int32_t q_index = DecisionIndex(v.imag());
+        uint8_t symbol[kNumQuanta][kNumQuanta];
+    };
+
+    static constexpr uint32_t AxisLabel(uint32_t index)
+    {
+        constexpr uint32_t kHalf = kNumQuanta / 2;
+        bool negative = (index < kHalf);
+        uint32_t magnitude = negative ? (kHalf - 1 - index) : (index - kHalf);
+        uint32_t gray = magnitude ^ (magnitude >> 1);
+        return (negative << (kBitsPerAxis - 1)) | gray;
+    }
 
-        constexpr uint8_t kIQtoSymbol[4][4] =
+    static constexpr SymbolTable ComputeSymbolTable(void)
+    {
+        constexpr uint32_t kMagnitudeBits = kBitsPerAxis - 1;
+        constexpr uint32_t kMagnitudeMask = (1 << kMagnitudeBits) - 1;
+        SymbolTable table{};
+
+        for (uint32_t i = 0; i < kNumQuanta; i++)
         {
-            {0xF, 0xD, 0x9, 0xB},
-            {0xE, 0xC, 0x8, 0xA},
-            {0x6, 0x4, 0x0, 0x2},
-            {0x7, 0x5, 0x1, 0x3},
-        };
+            for (uint32_t q = 0; q < kNumQuanta; q++)
+            {
+                uint32_t i_label = AxisLabel(i);
+                uint32_t q_label = AxisLabel(q);
+                table.symbol[i][q] =
+                    ((i_label >> kMagnitudeBits) << (bits_per_symbol - 1)) |
+                    ((q_label >> kMagnitudeBits) << (bits_per_symbol - 2)) |
+                    ((q_label & kMagnitudeMask) << kMagnitudeBits) |
+                    (i_label & kMagnitudeMask);
+            }
+        }
+
+        return table;
+    }
+
+    static constexpr SymbolTable kSymbolTable = ComputeSymbolTable();
+    static constexpr uint8_t kCarrierSyncSymbol = kSymbolTable.symbol[0][0];
 
-        return kIQtoSymbol[i_index][q_index];
+    uint8_t DecideSymbol(T fractional_delay = 0)
+    {
+        Vector v = SampleSymbol(fractional_delay);
+        int32_t i_index = DecisionIndex(v.real());
+        int32_t q_index = DecisionIndex(v.imag());
+        return kSymbolTable.symbol[i_index][q_index];
     }
 };
 
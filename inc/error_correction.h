@@ -23,6 +23,7 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 
 namespace quadra
 {
@@ -32,14 +33,56 @@ class HammingDecoder
 protected:
     uint32_t syndrome_;
     uint32_t bit_num_;
-    uint32_t parity_bits_;
+    uint32_t parity_mask_;
+    uint32_t residue_;
+
+    static uint32_t Parity(uint32_t x)
+    {
+        return __builtin_parity(x);
+    }
+
+    // Returns the XOR of the positions (0 through 31) of the set bits of x
+    static uint32_t PositionSyndrome(uint32_t x)
+    {
+        return (Parity(x & 0xAAAAAAAA) << 0) |
+               (Parity(x & 0xCCCCCCCC) << 1) |
+               (Parity(x & 0xF0F0F0F0) << 2) |
+               (Parity(x & 0xFF00FF00) << 3) |
+               (Parity(x & 0xFFFF0000) << 4);
+    }
+
+    // Returns true if no power of 2 lies among the count bit numbers
+    // starting at n
+    static bool Consecutive(uint32_t n, uint32_t count)
+    {
+        return ((n - 1) ^ (n + count - 1)) <= n - 1;
+    }
+
+    // Accumulate the syndrome of up to 32 bits which have consecutive bit
+    // numbers starting at n. The bits are realigned so that each word's bit
+    // numbers start at a multiple of 32. The syndrome of an aligned word is
+    // then the position syndrome of the word, plus its base bit number if
+    // it has odd parity. Since the position syndrome is linear, it can be
+    // computed once for the XOR of all the words (the residue).
+    static void Accumulate(uint32_t bits, uint32_t n,
+        uint32_t& syndrome, uint32_t& residue)
+    {
+        uint32_t shift = n % 32;
+        uint32_t base = n - shift;
+        uint64_t aligned = static_cast<uint64_t>(bits) << shift;
+        uint32_t lo = aligned;
+        uint32_t hi = aligned >> 32;
+        residue ^= lo ^ hi;
+        syndrome ^= (-Parity(lo) & base) ^ (-Parity(hi) & (base + 32));
+    }
 
 public:
-    void Init(uint32_t parity_bits)
+    void Init(void)
     {
         syndrome_ = 0;
         bit_num_ = 1;
-        parity_bits_ = parity_bits;
+        parity_mask_ = 0;
+        residue_ = 0;
     }
 
     // Instead of distributing the parity bits among the data bits, we use a
@@ -47,48 +90,420 @@ public:
     // keep track of the altered sequence of bit numbers. For example, since
     // the parity bit numbers are powers of 2, the data bits will be numbered
     // 3, 5, 6, 7, 9... etc, skipping the powers of 2.
-    void Process(uint8_t* data, uint32_t size)
+    //
+    // Data is processed in pieces as it arrives, and the parity bits are
+    // applied at the end, so that no step takes longer than a few bytes'
+    // worth of work.
+    void Process(uint8_t byte)
     {
-        // Calculate the error syndrome
-        for (uint32_t i = 0; i < size * 8; i++)
+        if (Consecutive(bit_num_, 8))
+        {
+            Accumulate(byte, bit_num_, syndrome_, residue_);
+            bit_num_ += 8;
+            return;
+        }
+
+        for (uint32_t i = 0; i < 8; i++)
         {
-            // For all power-of-2 bit numbers, use the corresponding parity bit
-            // and then skip that number in the sequence of data bit numbers.
+            // For all power-of-2 bit numbers, note that the corresponding
+            // parity bit is to be used and then skip that number in the
+            // sequence of data bit numbers.
             while ((bit_num_ & (bit_num_ - 1)) == 0)
             {
-                syndrome_ ^= parity_bits_ & bit_num_;
+                parity_mask_ |= bit_num_;
                 bit_num_++;
             }
 
-            uint32_t bit = (data[i / 8] >> (i % 8)) & 1;
-
-            if (bit)
+            if ((byte >> i) & 1)
             {
                 syndrome_ ^= bit_num_;
             }
 
             bit_num_++;
         }
+    }
+
+    void Process(const uint8_t* data, uint32_t size)
+    {
+        while (size)
+        {
+            uint32_t n = bit_num_;
+            uint32_t syndrome = 0;
+            uint32_t residue = 0;
+
+            while (size >= 4 && Consecutive(n, 32))
+            {
+                uint32_t word = (data[0] <<  0) | (data[1] <<  8) |
+                    (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+                Accumulate(word, n, syndrome, residue);
+                n += 32;
+                data += 4;
+                size -= 4;
+            }
+
+            bit_num_ = n;
+            syndrome_ ^= syndrome;
+            residue_ ^= residue;
+
+            if (size)
+            {
+                Process(*(data++));
+                size--;
+            }
+        }
+    }
+
+    // Returns the parity bits which an encoder sends with the data processed
+    // so far
+    uint32_t parity(void)
+    {
+        return syndrome_ ^ PositionSyndrome(residue_);
+    }
+
+    // Apply the parity bits to the error syndrome. If an error is detected in
+    // a data bit, returns true and sets bit_pos to the position of that bit
+    // (numbered from the LSB of the first byte). The caller should check that
+    // the position lies within the data.
+    bool Finalize(uint32_t parity_bits, uint32_t& bit_pos)
+    {
+        uint32_t syndrome = syndrome_ ^ PositionSyndrome(residue_) ^
+            (parity_bits & parity_mask_);
 
         // If the syndrome is 0, there was no error detected. If it's a power
         // of 2, then one of the parity bits is flipped, which we don't care
         // about. Otherwise, do error correction.
-        if ((syndrome_ & (syndrome_ - 1)) != 0)
+        if ((syndrome & (syndrome - 1)) != 0)
+        {
+            uint32_t width = sizeof(syndrome) * 8 - __builtin_clz(syndrome);
+            bit_pos = syndrome - 1 - width;
+            return true;
+        }
+
+        return false;
+    }
+
+    // Process a whole buffer of data and correct it in place
+    void Process(uint8_t* data, uint32_t size, uint32_t parity_bits)
+    {
+        Init();
+        Process(static_cast<const uint8_t*>(data), size);
+
+        uint32_t bit_pos;
+
+        if (Finalize(parity_bits, bit_pos) && bit_pos < size * 8)
+        {
+            data[bit_pos / 8] ^= 1 << (bit_pos % 8);
+        }
+    }
+
+    void Process(void* data, uint32_t size, uint32_t parity_bits)
+    {
+        Process(reinterpret_cast<uint8_t*>(data), size, parity_bits);
+    }
+};
+
+// Arithmetic in GF(256) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 and
+// generator 2. The log and antilog tables are computed at compile time and
+// placed in read-only memory.
+class GaloisField
+{
+public:
+    static constexpr uint32_t kPolynomial = 0x11D;
+    static constexpr uint32_t kOrder = 255;
+
+    // Returns 2^n, for n < 2 * kOrder
+    static uint8_t Exp(uint32_t n)
+    {
+        return kTables.exp[n];
+    }
+
+    // Returns the logarithm of x, which must be nonzero
+    static uint32_t Log(uint8_t x)
+    {
+        return kTables.log[x];
+    }
+
+    static uint8_t Multiply(uint8_t a, uint8_t b)
+    {
+        return (a && b) ? Exp(Log(a) + Log(b)) : 0;
+    }
+
+    // Returns the inverse of x, which must be nonzero
+    static uint8_t Inverse(uint8_t x)
+    {
+        return Exp(kOrder - Log(x));
+    }
+
+protected:
+    struct Tables
+    {
+        uint8_t exp[2 * kOrder];
+        uint8_t log[256];
+    };
+
+    static constexpr Tables ComputeTables(void)
+    {
+        Tables tables{};
+        uint32_t x = 1;
+
+        for (uint32_t i = 0; i < kOrder; i++)
+        {
+            tables.exp[i] = x;
+            tables.exp[i + kOrder] = x;
+            tables.log[x] = i;
+            x <<= 1;
+            x = (x & 0x100) ? (x ^ kPolynomial) : x;
+        }
+
+        return tables;
+    }
+
+    static const Tables kTables;
+};
+
+inline constexpr GaloisField::Tables GaloisField::kTables =
+    GaloisField::ComputeTables();
+
+// Erasure decoder for a systematic Reed-Solomon code over GF(256) which is
+// applied across a sequence of num_data data shards followed by num_parity
+// parity shards, each length bytes long. Byte i of every shard belongs to
+// codeword i, and the first shard holds the highest-order coefficients.
+// The generator polynomial has roots 2^0 through 2^(num_parity-1).
+//
+// The locations of corrupt shards are known (e.g. from a failed CRC), so up
+// to num_parity of them may be recovered. Syndromes are accumulated as each
+// shard arrives, so storage is needed only for the syndromes and not for
+// the parity shards themselves, and finishing a block requires work only
+// in proportion to the number of erasures.
+template <uint32_t num_data, uint32_t num_parity, uint32_t length>
+class ReedSolomonDecoder
+{
+protected:
+    static constexpr uint32_t kNumShards = num_data + num_parity;
+    static_assert(kNumShards <= GaloisField::kOrder, "Too many shards");
+
+    uint8_t syndromes_[num_parity][length];
+    uint8_t erasures_[num_parity];
+    uint32_t num_erasures_;
+
+    // Returns the log of the locator of the given shard
+    static uint32_t Locator(uint32_t shard)
+    {
+        return kNumShards - 1 - shard;
+    }
+
+public:
+    void Init(void)
+    {
+        std::memset(syndromes_, 0, sizeof(syndromes_));
+        num_erasures_ = 0;
+    }
+
+    // Accumulate the given shard, which is known to be correct. Shards may
+    // be processed in any order, but each only once.
+    void Process(const uint8_t* data, uint32_t shard)
+    {
+        uint32_t locator = Locator(shard);
+
+        for (uint32_t j = 0; j < length; j++)
         {
-            uint32_t width = sizeof(syndrome_) * 8 - __builtin_clz(syndrome_);
-            uint32_t bit_pos = syndrome_ - 1 - width;
+            syndromes_[0][j] ^= data[j];
+        }
 
-            if (bit_pos < size * 8)
+        for (uint32_t i = 1; i < num_parity; i++)
+        {
+            uint32_t factor = (i * locator) % GaloisField::kOrder;
+            uint8_t* syndrome = syndromes_[i];
+
+            for (uint32_t j = 0; j < length; j++)
             {
-                data[bit_pos / 8] ^= 1 << (bit_pos % 8);
+                if (data[j])
+                {
+                    syndrome[j] ^=
+                        GaloisField::Exp(GaloisField::Log(data[j]) + factor);
+                }
             }
         }
     }
 
-    void Process(void* data, uint32_t size)
+    // Skip the given shard, which is known to be corrupt. Returns false if
+    // there are too many erasures to recover from.
+    bool Erase(uint32_t shard)
     {
-        Process(reinterpret_cast<uint8_t*>(data), size);
+        if (num_erasures_ < num_parity)
+        {
+            erasures_[num_erasures_++] = shard;
+            return true;
+        }
+
+        return false;
     }
+
+    // Recover the erased data shards in place. Data points to the data
+    // shards, which must be stored contiguously. An erased shard's contents
+    // are ignored.
+    void Correct(uint8_t* data)
+    {
+        // Erasure locator polynomial, lambda(x) = prod(1 + X_k x)
+        uint8_t lambda[num_parity + 1] = {1};
+
+        for (uint32_t k = 0; k < num_erasures_; k++)
+        {
+            uint8_t x = GaloisField::Exp(Locator(erasures_[k]));
+
+            for (uint32_t m = k + 1; m > 0; m--)
+            {
+                lambda[m] ^= GaloisField::Multiply(lambda[m - 1], x);
+            }
+        }
+
+        for (uint32_t k = 0; k < num_erasures_; k++)
+        {
+            if (erasures_[k] >= num_data)
+            {
+                continue;
+            }
+
+            // By the Forney algorithm, the erased value is
+            // X omega(1/X) / lambda'(1/X), where omega(x) = s(x) lambda(x)
+            // modulo x^num_parity. Since the erasure locations are the same
+            // for every codeword, this reduces to a fixed linear combination
+            // of the syndromes.
+            uint32_t locator = Locator(erasures_[k]);
+            uint32_t x_inv = (GaloisField::kOrder - locator) %
+                GaloisField::kOrder;
+
+            // The formal derivative has only the odd terms
+            uint8_t derivative = 0;
+
+            for (uint32_t m = 1; m <= num_erasures_; m += 2)
+            {
+                derivative ^= GaloisField::Multiply(lambda[m],
+                    GaloisField::Exp((x_inv * (m - 1)) % GaloisField::kOrder));
+            }
+
+            uint8_t scale = GaloisField::Multiply(
+                GaloisField::Exp(locator), GaloisField::Inverse(derivative));
+            uint8_t weights[num_parity];
+
+            for (uint32_t i = 0; i < num_parity; i++)
+            {
+                uint8_t sum = 0;
+
+                for (uint32_t m = 0; m <= num_erasures_ && i + m < num_parity;
+                    m++)
+                {
+                    sum ^= GaloisField::Multiply(lambda[m], GaloisField::Exp(
+                        (x_inv * (i + m)) % GaloisField::kOrder));
+                }
+
+                weights[i] = GaloisField::Multiply(sum, scale);
+            }
+
+            uint8_t* shard = &data[erasures_[k] * length];
+
+            for (uint32_t j = 0; j < length; j++)
+            {
+                uint8_t value = 0;
+
+                for (uint32_t i = 0; i < num_parity; i++)
+                {
+                    value ^= GaloisField::Multiply(syndromes_[i][j],
+                        weights[i]);
+                }
+
+                shard[j] = value;
+            }
+        }
+    }
+};
+
+// With no parity shards, nothing can be recovered
+template <uint32_t num_data, uint32_t length>
+class ReedSolomonDecoder<num_data, 0, length>
+{
+public:
+    void Init(void) {}
+    void Process(const uint8_t*, uint32_t) {}
+    bool Erase(uint32_t) {return false;}
+    void Correct(uint8_t*) {}
+};
+
+// Encoder for the same code. The data shards are processed in order, and
+// the parity shards are the remainder of the division of the data by the
+// generator polynomial, which is computed one codeword per byte position
+// with a shift register.
+template <uint32_t num_data, uint32_t num_parity, uint32_t length>
+class ReedSolomonEncoder
+{
+protected:
+    static_assert(num_data + num_parity <= GaloisField::kOrder,
+        "Too many shards");
+
+    // Coefficients of the generator polynomial, excluding the leading 1
+    uint8_t generator_[num_parity];
+    uint8_t remainder_[num_parity][length];
+
+public:
+    void Init(void)
+    {
+        // g(x) = prod(x + 2^i), highest order coefficient first
+        uint8_t g[num_parity + 1] = {1};
+
+        for (uint32_t i = 0; i < num_parity; i++)
+        {
+            for (uint32_t m = i + 1; m > 0; m--)
+            {
+                g[m] ^= GaloisField::Multiply(g[m - 1], GaloisField::Exp(i));
+            }
+        }
+
+        for (uint32_t i = 0; i < num_parity; i++)
+        {
+            generator_[i] = g[i + 1];
+        }
+
+        Reset();
+    }
+
+    void Reset(void)
+    {
+        std::memset(remainder_, 0, sizeof(remainder_));
+    }
+
+    // Accumulate the next data shard
+    void Process(const uint8_t* data)
+    {
+        for (uint32_t j = 0; j < length; j++)
+        {
+            uint8_t feedback = data[j] ^ remainder_[0][j];
+
+            for (uint32_t i = 0; i + 1 < num_parity; i++)
+            {
+                remainder_[i][j] = remainder_[i + 1][j] ^
+                    GaloisField::Multiply(generator_[i], feedback);
+            }
+
+            remainder_[num_parity - 1][j] =
+                GaloisField::Multiply(generator_[num_parity - 1], feedback);
+        }
+    }
+
+    // Returns the given parity shard, once every data shard is processed
+    const uint8_t* parity(uint32_t shard)
+    {
+        return remainder_[shard];
+    }
+};
+
+template <uint32_t num_data, uint32_t length>
+class ReedSolomonEncoder<num_data, 0, length>
+{
+public:
+    void Init(void) {}
+    void Reset(void) {}
+    void Process(const uint8_t*) {}
+    const uint8_t* parity(uint32_t) {return nullptr;}
 };
 
 }
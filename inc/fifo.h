@@ -131,6 +131,146 @@ public:
         T item;
         return Pop(item);
     }
+
+    // Point items at the oldest readable item and return the number of items
+    // which may be read contiguously from there. At most the items up to the
+    // end of the underlying array are returned, so a second call (after
+    // consuming the first span) is needed to read the remainder.
+    uint32_t Peek(const T*& items)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        uint32_t offset = head % size;
+        uint32_t contiguous = size - offset;
+
+        items = &data_[offset];
+        return (tail - head < contiguous) ? (tail - head) : contiguous;
+    }
+
+    // Point first at the oldest readable item and second at the start of
+    // the underlying array, where the readable items continue if they wrap
+    // around. Returns the total number of readable items, of which the
+    // first first_length are contiguous from first and the rest from second.
+    uint32_t Peek(const T*& first, uint32_t& first_length, const T*& second)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        uint32_t offset = head % size;
+        uint32_t contiguous = size - offset;
+        uint32_t length = tail - head;
+
+        first = &data_[offset];
+        first_length = (length < contiguous) ? length : contiguous;
+        second = &data_[0];
+        return length;
+    }
+
+    // Release items previously read via Peek. Length must not exceed the
+    // number of items available.
+    void Consume(uint32_t length)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        head_.store(head + length, std::memory_order_release);
+    }
+};
+
+// A FIFO over storage owned by the caller, such as a circular DMA buffer.
+// Rather than pushing items, the producer writes them into the storage in
+// order and then commits them, so they're never copied. The storage may be
+// any length. Positions run from 0 to twice the length so that a full
+// buffer can be told apart from an empty one without a division.
+template<typename T>
+class ExternalFifo
+{
+protected:
+    std::atomic<uint32_t> head_;
+    std::atomic<uint32_t> tail_;
+    const T* data_;
+    uint32_t size_;
+
+    uint32_t Advance(uint32_t position, uint32_t length)
+    {
+        position += length;
+        return (position >= 2 * size_) ? (position - 2 * size_) : position;
+    }
+
+    uint32_t Distance(uint32_t head, uint32_t tail)
+    {
+        return (tail >= head) ? (tail - head) : (tail + 2 * size_ - head);
+    }
+
+public:
+    void Init(void)
+    {
+        head_.store(0, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
+    }
+
+    void Attach(const T* storage, uint32_t size)
+    {
+        data_ = storage;
+        size_ = size;
+        Init();
+    }
+
+    void Flush(void)
+    {
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        head_.store(tail, std::memory_order_release);
+    }
+
+    bool empty(void)
+    {
+        return !available();
+    }
+
+    uint32_t available(void)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        return Distance(head, tail);
+    }
+
+    // Publish the next length items, which the producer has already written
+    // to the storage. The producer is assumed to go on to write the next
+    // length items straight away (as with each half of a DMA buffer), so
+    // returns false if those would overwrite any unread items.
+    bool Commit(uint32_t length)
+    {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        uint32_t head = head_.load(std::memory_order_acquire);
+        tail = Advance(tail, length);
+        tail_.store(tail, std::memory_order_release);
+        return Distance(head, tail) <= size_ - length;
+    }
+
+    uint32_t Peek(const T*& items)
+    {
+        const T* second;
+        uint32_t length;
+        Peek(items, length, second);
+        return length;
+    }
+
+    uint32_t Peek(const T*& first, uint32_t& first_length, const T*& second)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        uint32_t offset = (head >= size_) ? (head - size_) : head;
+        uint32_t contiguous = size_ - offset;
+        uint32_t length = Distance(head, tail);
+
+        first = &data_[offset];
+        first_length = (length < contiguous) ? length : contiguous;
+        second = &data_[0];
+        return length;
+    }
+
+    void Consume(uint32_t length)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        head_.store(Advance(head, length), std::memory_order_release);
+    }
 };
 
 }
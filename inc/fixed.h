@@ -0,0 +1,211 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+#include "util.h"
+
+namespace quadra
+{
+
+// Signed fixed-point number stored in 32 bits, with the given number of
+// fractional bits. This may be used in place of float as the sample type of
+// the decoder on targets without a hardware floating-point unit.
+//
+// The decoder needs some headroom above 1.0 (e.g. for the AGC gain and the
+// correlator sum), so fractional_bits should be no more than 24.
+template <int32_t fractional_bits>
+class Fixed
+{
+protected:
+    static_assert(fractional_bits >= 8 && fractional_bits <= 24);
+    static constexpr int32_t kOne = 1 << fractional_bits;
+    static constexpr int32_t kFractionMask = kOne - 1;
+
+    int32_t raw_;
+
+public:
+    Fixed() = default;
+
+    // Conversions from arithmetic types are implicit so that constants may
+    // be written naturally. They are evaluated at compile time when the
+    // argument is a constant.
+    template <typename U,
+        typename = std::enable_if_t<std::is_arithmetic_v<U>>>
+    constexpr Fixed(U x) :
+        raw_(std::is_integral_v<U> ?
+            static_cast<int32_t>(x * kOne) :
+            static_cast<int32_t>(x * kOne + ((x < 0) ? -0.5 : 0.5)))
+    {}
+
+    static constexpr Fixed FromRaw(int32_t raw)
+    {
+        Fixed x{};
+        x.raw_ = raw;
+        return x;
+    }
+
+    constexpr int32_t raw(void) const
+    {
+        return raw_;
+    }
+
+    // Truncates toward zero, like the conversion from float
+    explicit constexpr operator int32_t(void) const
+    {
+        return (raw_ < 0) ? -(-raw_ >> fractional_bits) :
+                            (raw_ >> fractional_bits);
+    }
+
+    explicit constexpr operator float(void) const
+    {
+        return raw_ * (1.f / kOne);
+    }
+
+    constexpr Fixed operator-(void) const
+    {
+        return FromRaw(-raw_);
+    }
+
+    constexpr Fixed& operator+=(Fixed b) {raw_ += b.raw_; return *this;}
+    constexpr Fixed& operator-=(Fixed b) {raw_ -= b.raw_; return *this;}
+    constexpr Fixed& operator*=(Fixed b) {return *this = *this * b;}
+    constexpr Fixed& operator/=(Fixed b) {return *this = *this / b;}
+
+    friend constexpr Fixed operator+(Fixed a, Fixed b)
+    {
+        return FromRaw(a.raw_ + b.raw_);
+    }
+
+    friend constexpr Fixed operator-(Fixed a, Fixed b)
+    {
+        return FromRaw(a.raw_ - b.raw_);
+    }
+
+    friend constexpr Fixed operator*(Fixed a, Fixed b)
+    {
+        int64_t product = static_cast<int64_t>(a.raw_) * b.raw_;
+        return FromRaw(static_cast<int32_t>(product >> fractional_bits));
+    }
+
+    friend constexpr Fixed operator/(Fixed a, Fixed b)
+    {
+        int64_t dividend = static_cast<int64_t>(a.raw_) << fractional_bits;
+        return FromRaw(static_cast<int32_t>(dividend / b.raw_));
+    }
+
+    friend constexpr bool operator==(Fixed a, Fixed b) {return a.raw_ == b.raw_;}
+    friend constexpr bool operator!=(Fixed a, Fixed b) {return a.raw_ != b.raw_;}
+    friend constexpr bool operator< (Fixed a, Fixed b) {return a.raw_ <  b.raw_;}
+    friend constexpr bool operator> (Fixed a, Fixed b) {return a.raw_ >  b.raw_;}
+    friend constexpr bool operator<=(Fixed a, Fixed b) {return a.raw_ <= b.raw_;}
+    friend constexpr bool operator>=(Fixed a, Fixed b) {return a.raw_ >= b.raw_;}
+
+    friend constexpr Fixed Abs(Fixed x)
+    {
+        return (x.raw_ < 0) ? -x : x;
+    }
+
+    friend constexpr Fixed IntegerPart(Fixed x)
+    {
+        return FromRaw((x.raw_ < 0) ? -(-x.raw_ & ~kFractionMask) :
+                                      (x.raw_ & ~kFractionMask));
+    }
+
+    friend constexpr Fixed FractionalPart(Fixed x)
+    {
+        return x - IntegerPart(x);
+    }
+
+    friend constexpr Fixed Wrap(Fixed x)
+    {
+        return FromRaw(x.raw_ & kFractionMask);
+    }
+};
+
+template <int32_t fractional_bits>
+struct FixedSineTable
+{
+    Fixed<fractional_bits> value[65];
+};
+
+template <int32_t fractional_bits>
+constexpr FixedSineTable<fractional_bits> MakeFixedSineTable(void)
+{
+    FixedSineTable<fractional_bits> table{};
+
+    for (uint32_t i = 0; i < 65; i++)
+    {
+        table.value[i] = kSineQuadrant[i];
+    }
+
+    return table;
+}
+
+template <int32_t fractional_bits>
+inline constexpr FixedSineTable<fractional_bits> kFixedSineQuadrant =
+    MakeFixedSineTable<fractional_bits>();
+
+template <int32_t fractional_bits>
+inline Fixed<fractional_bits> Sine(Fixed<fractional_bits> t)
+{
+    // The index wraps naturally in two's complement
+    uint32_t index = static_cast<uint32_t>(t.raw()) >> (fractional_bits - 8);
+    uint32_t quadrant = (index & 0xC0) >> 6;
+    index &= 0x3F;
+
+    if (quadrant & 1)
+    {
+        index = 0x40 - index;
+    }
+
+    auto y = kFixedSineQuadrant<fractional_bits>.value[index];
+    return (quadrant & 2) ? -y : y;
+}
+
+template <int32_t fractional_bits>
+inline Fixed<fractional_bits> Cosine(Fixed<fractional_bits> t)
+{
+    return Sine(t + Fixed<fractional_bits>(0.25));
+}
+
+template <int32_t fractional_bits>
+inline void SinCos(Fixed<fractional_bits> t,
+    Fixed<fractional_bits>& sine, Fixed<fractional_bits>& cosine)
+{
+    using F = Fixed<fractional_bits>;
+    const auto& table = kSineCycle<F>.value;
+    constexpr int32_t kFractionBits = fractional_bits - 8;
+
+    // The index wraps naturally in two's complement, and the remaining bits
+    // are the interpolation fraction
+    uint32_t raw = static_cast<uint32_t>(t.raw());
+    uint32_t index = (raw >> kFractionBits) & 0xFF;
+    F f = F::FromRaw((raw & ((1 << kFractionBits) - 1)) << 8);
+
+    sine = Lerp(table[index], table[index + 1], f);
+    cosine = Lerp(table[index + 64], table[index + 65], f);
+}
+
+}
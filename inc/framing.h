@@ -0,0 +1,287 @@
+// MIT License
+//
+// Copyright 2013 Émilie Gillet
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include "crc32.h"
+#include "packet.h"
+
+namespace quadra
+{
+
+enum FrameEvent
+{
+    FRAME_NONE,
+    FRAME_BLOCK,
+    FRAME_METADATA,
+    FRAME_ADDRESS,
+    FRAME_END,
+    FRAME_ERROR_SYNC,
+    FRAME_ERROR_CRC,
+};
+
+// Receives everything in a transfer other than the data packets of each
+// block: the block and end markers, the metadata packet which follows the
+// first block marker, and the address which precedes each block of a sparse
+// transfer. Each decoder keeps one Framer per signal, and handles the data
+// packets itself once in_block returns true, using the packet given by
+// packet().
+template <uint32_t packet_size,
+    uint32_t block_size,
+    typename Crc = Crc32,
+    uint32_t bits_per_symbol = 4>
+class Framer
+{
+protected:
+    static constexpr uint32_t kMarkerLength = 2;
+    static constexpr uint32_t kBlockMarker = 0x03;
+    static constexpr uint32_t kEndMarker   = 0x03 << bits_per_symbol;
+    static constexpr uint32_t kAddressedBlockMarker =
+        kBlockMarker | kEndMarker;
+    static_assert(packet_size >= 4);
+
+    // The metadata of a delta transfer also holds flags and the checksum of
+    // the whole image, which needs a packet of at least 12 bytes
+    static constexpr uint32_t kMetadataDelta = 1 << 0;
+    static constexpr bool kExtendedMetadata = (packet_size >= 12);
+
+    enum State
+    {
+        STATE_SYNC,
+        STATE_META,
+        STATE_ADDRESS,
+        STATE_BLOCK,
+    };
+
+    State state_;
+    uint32_t marker_count_;
+    uint32_t marker_code_;
+    uint32_t crc_seed_;
+    Packet<packet_size, Crc, bits_per_symbol> packet_;
+    Packet<4, Crc, bits_per_symbol> address_;
+    bool has_metadata_;
+    bool sparse_;
+    bool delta_;
+    uint32_t total_size_bytes_;
+    uint32_t image_crc_;
+    uint32_t block_index_;
+
+    static uint32_t ReadWord(const uint8_t* data)
+    {
+        return data[0] | (data[1] << 8) | (data[2] << 16) |
+            (uint32_t(data[3]) << 24);
+    }
+
+    FrameEvent Sync(uint8_t symbol)
+    {
+        marker_code_ = (marker_code_ << bits_per_symbol) | symbol;
+        marker_count_--;
+
+        if (marker_count_)
+        {
+            return FRAME_NONE;
+        }
+        else if (marker_code_ == kBlockMarker ||
+            marker_code_ == kAddressedBlockMarker)
+        {
+            // In a sparse transfer, each block is preceded by its address,
+            // which follows the metadata if there is any
+            sparse_ = (marker_code_ == kAddressedBlockMarker);
+            state_ = !has_metadata_ ? STATE_META :
+                sparse_ ? STATE_ADDRESS : STATE_BLOCK;
+            return FRAME_BLOCK;
+        }
+        else if (marker_code_ == kEndMarker)
+        {
+            return FRAME_END;
+        }
+        else
+        {
+            return FRAME_ERROR_SYNC;
+        }
+    }
+
+    FrameEvent GetMetadata(uint8_t symbol)
+    {
+        packet_.WriteSymbol(symbol);
+
+        if (!packet_.full())
+        {
+            return FRAME_NONE;
+        }
+        else if (!packet_.valid())
+        {
+            return FRAME_ERROR_CRC;
+        }
+
+        const uint8_t* data = packet_.data();
+        total_size_bytes_ = ReadWord(data);
+
+        if constexpr (kExtendedMetadata)
+        {
+            delta_ = ReadWord(data + 4) & kMetadataDelta;
+            image_crc_ = ReadWord(data + 8);
+        }
+
+        packet_.Reset();
+        has_metadata_ = true;
+        state_ = sparse_ ? STATE_ADDRESS : STATE_BLOCK;
+        return FRAME_METADATA;
+    }
+
+    FrameEvent GetAddress(uint8_t symbol)
+    {
+        address_.WriteSymbol(symbol);
+
+        if (!address_.full())
+        {
+            return FRAME_NONE;
+        }
+        else if (!address_.valid())
+        {
+            return FRAME_ERROR_CRC;
+        }
+
+        block_index_ = ReadWord(address_.data());
+        address_.Reset();
+        state_ = STATE_BLOCK;
+        return FRAME_ADDRESS;
+    }
+
+public:
+    void Init(uint32_t crc_seed)
+    {
+        crc_seed_ = crc_seed;
+        packet_.Init(crc_seed);
+        address_.Init(crc_seed);
+        Reset();
+    }
+
+    // Forget the metadata, ready for a new transfer
+    void Reset(void)
+    {
+        packet_.Reset();
+        address_.Reset();
+        has_metadata_ = false;
+        sparse_ = false;
+        delta_ = false;
+        total_size_bytes_ = 0;
+        image_crc_ = 0;
+        block_index_ = 0;
+        BeginSync();
+    }
+
+    // Wait for the next block or end marker
+    void BeginSync(void)
+    {
+        state_ = STATE_SYNC;
+        marker_count_ = kMarkerLength;
+        marker_code_ = 0;
+    }
+
+    FrameEvent Process(uint8_t symbol)
+    {
+        if (state_ == STATE_SYNC)
+        {
+            return Sync(symbol);
+        }
+        else if (state_ == STATE_META)
+        {
+            return GetMetadata(symbol);
+        }
+        else if (state_ == STATE_ADDRESS)
+        {
+            return GetAddress(symbol);
+        }
+
+        return FRAME_NONE;
+    }
+
+    // True once the block's marker, and any metadata and address, have
+    // been received, so that the following symbols belong to its packets
+    bool in_block(void)
+    {
+        return state_ == STATE_BLOCK;
+    }
+
+    Packet<packet_size, Crc, bits_per_symbol>& packet(void)
+    {
+        return packet_;
+    }
+
+    bool sparse(void)
+    {
+        return sparse_;
+    }
+
+    bool delta(void)
+    {
+        return delta_;
+    }
+
+    uint32_t total_size_bytes(void)
+    {
+        return total_size_bytes_;
+    }
+
+    // Offset in bytes of the block whose address was last received
+    uint32_t address_offset(void)
+    {
+        return block_index_ * block_size;
+    }
+
+    // Blocks must arrive in order, and lie within the size given by the
+    // metadata
+    bool address_valid(uint32_t bytes_received)
+    {
+        return block_index_ < total_size_bytes_ / block_size &&
+            address_offset() >= bytes_received;
+    }
+
+    // Checks the image against the checksum sent with a delta transfer.
+    // read(offset, length) returns a pointer to that many bytes of the
+    // image. Other transfers carry no such checksum, and always pass.
+    template <typename Read>
+    bool VerifyImage(Read&& read)
+    {
+        if (!delta_)
+        {
+            return true;
+        }
+
+        Crc crc;
+        crc.Init();
+        crc.Seed(crc_seed_);
+
+        for (uint32_t offset = 0; offset < total_size_bytes_;
+            offset += block_size)
+        {
+            crc.Process(read(offset, block_size), block_size);
+        }
+
+        return crc.crc() == image_crc_;
+    }
+};
+
+}
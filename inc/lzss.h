@@ -0,0 +1,197 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace quadra
+{
+
+// Streaming decoder for the LZSS format produced by encoder.py.
+//
+// The compressed stream is a sequence of groups, each consisting of a flag
+// byte followed by up to 8 items. Bit i of the flag byte (from the LSB)
+// describes item i: if clear, the item is a literal byte; if set, it's a
+// 16-bit little-endian match token whose low window_bits bits hold the
+// distance minus 1, and whose remaining bits hold the length minus
+// kMinMatch. The decoder keeps the most recent 2^window_bits bytes of
+// output in a window so that input and output may be supplied in pieces
+// of any size.
+template <uint32_t window_bits>
+class LzssDecoder
+{
+protected:
+    static_assert(window_bits >= 8 && window_bits <= 12);
+    static constexpr uint32_t kWindowSize = 1 << window_bits;
+    static constexpr uint32_t kMinMatch = 3;
+
+    uint8_t window_[kWindowSize];
+    uint32_t position_;
+    uint32_t flags_;
+    uint32_t token_;
+    uint32_t token_size_;
+    uint32_t match_source_;
+    uint32_t match_length_;
+
+public:
+    void Init(void)
+    {
+        // A corrupt stream may refer back past the start of the output, so
+        // the window must not hold stale or uninitialized bytes
+        std::memset(window_, 0, sizeof(window_));
+        position_ = 0;
+        flags_ = 1;
+        token_ = 0;
+        token_size_ = 0;
+        match_source_ = 0;
+        match_length_ = 0;
+    }
+
+    // Decompress from input until it's exhausted or capacity bytes have been
+    // written to output. Sets consumed to the number of input bytes used and
+    // returns the number of output bytes written.
+    uint32_t Process(const uint8_t* input, uint32_t length, uint32_t& consumed,
+        uint8_t* output, uint32_t capacity)
+    {
+        uint32_t i = 0;
+        uint32_t o = 0;
+
+        while (o < capacity)
+        {
+            uint8_t byte;
+
+            if (match_length_)
+            {
+                byte = window_[match_source_++ % kWindowSize];
+                match_length_--;
+            }
+            else if (i == length)
+            {
+                break;
+            }
+            else if (flags_ == 1)
+            {
+                // The extra bit marks the end of the group
+                flags_ = 0x100 | input[i++];
+                continue;
+            }
+            else if (flags_ & 1)
+            {
+                token_ |= input[i++] << (8 * token_size_);
+
+                if (++token_size_ == 2)
+                {
+                    match_source_ = position_ - (token_ % kWindowSize) - 1;
+                    match_length_ = (token_ >> window_bits) + kMinMatch;
+                    token_ = 0;
+                    token_size_ = 0;
+                    flags_ >>= 1;
+                }
+
+                continue;
+            }
+            else
+            {
+                byte = input[i++];
+                flags_ >>= 1;
+            }
+
+            window_[position_++ % kWindowSize] = byte;
+            output[o++] = byte;
+        }
+
+        consumed = i;
+        return o;
+    }
+};
+
+// Decompresses a stream of received blocks into output blocks of the same
+// size. The number of output blocks produced from each received block
+// varies. A window_bits of 0 disables decompression.
+template <uint32_t block_size, uint32_t window_bits>
+class BlockDecompressor
+{
+protected:
+    LzssDecoder<window_bits> lzss_;
+    uint32_t output_[block_size / 4];
+    uint32_t output_size_;
+    const uint8_t* input_;
+    uint32_t input_size_;
+
+public:
+    void Init(void)
+    {
+        lzss_.Init();
+        output_size_ = 0;
+        input_ = nullptr;
+        input_size_ = 0;
+    }
+
+    // Supply the next received block. It must remain unchanged until
+    // Process returns false.
+    void Feed(const uint32_t* data)
+    {
+        input_ = reinterpret_cast<const uint8_t*>(data);
+        input_size_ = block_size;
+    }
+
+    // Decompress until an output block is completed or the received block
+    // is exhausted. Returns true in the former case, after which the output
+    // may be retrieved with data.
+    bool Process(void)
+    {
+        uint8_t* output = reinterpret_cast<uint8_t*>(output_);
+        uint32_t consumed;
+
+        output_size_ += lzss_.Process(input_, input_size_, consumed,
+            output + output_size_, block_size - output_size_);
+        input_ += consumed;
+        input_size_ -= consumed;
+
+        if (output_size_ == block_size)
+        {
+            output_size_ = 0;
+            return true;
+        }
+
+        return false;
+    }
+
+    const uint32_t* data(void)
+    {
+        return output_;
+    }
+};
+
+template <uint32_t block_size>
+class BlockDecompressor<block_size, 0>
+{
+public:
+    void Init(void) {}
+    void Feed(const uint32_t*) {}
+    bool Process(void) {return false;}
+    const uint32_t* data(void) {return nullptr;}
+};
+
+}
@@ -0,0 +1,126 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+namespace quadra
+{
+
+// QAM modulator matching the one in encoder.py sample for sample. Each
+// symbol is one cycle of a carrier at the symbol rate, of which the
+// in-phase and quadrature amplitudes are taken from the constellation.
+// The samples of every symbol are computed once, by Init.
+template <uint32_t sample_rate,
+          uint32_t symbol_rate,
+          uint32_t bits_per_symbol = 4>
+class Modulator
+{
+public:
+    static_assert(sample_rate % symbol_rate == 0,
+        "Sample rate must be a multiple of the symbol rate");
+    static_assert(bits_per_symbol == 2 || bits_per_symbol == 4 ||
+        bits_per_symbol == 6, "Only 4-, 16-, and 64-QAM are supported");
+    static constexpr uint32_t kSymbolDuration = sample_rate / symbol_rate;
+    static constexpr uint32_t kNumSymbols = 1 << bits_per_symbol;
+    static constexpr uint32_t kAlignmentLength = 16;
+
+    void Init(void)
+    {
+        // Square constellation in which each axis is Gray coded in
+        // sign-magnitude form. The sign bits of x and y are the two most
+        // significant bits of the symbol, followed by the Gray-coded
+        // magnitudes of y and then x.
+        int32_t levels[kNumLevels];
+
+        for (uint32_t magnitude = 0; magnitude < kNumLevels; magnitude++)
+        {
+            levels[magnitude ^ (magnitude >> 1)] = 2 * magnitude + 1;
+        }
+
+        const double amplitude = (2 << (kBitsPerAxis - 1)) - 1;
+
+        for (uint32_t symbol = 0; symbol < kNumSymbols; symbol++)
+        {
+            int32_t x = levels[symbol & kMagnitudeMask];
+            int32_t y = levels[(symbol >> kMagnitudeBits) & kMagnitudeMask];
+            x = (symbol & (1 << (bits_per_symbol - 1))) ? -x : x;
+            y = (symbol & (1 << (bits_per_symbol - 2))) ? -y : y;
+
+            for (uint32_t i = 0; i < kSymbolDuration; i++)
+            {
+                double phase = 2 * kPi * i / kSymbolDuration;
+                double sample = x * std::cos(phase) - y * std::sin(phase);
+                sample /= amplitude * std::sqrt(2.0);
+                table_[symbol][i] = static_cast<int16_t>(32767 * sample);
+            }
+        }
+    }
+
+    // Returns the kSymbolDuration samples of the given symbol
+    const int16_t* samples(uint8_t symbol)
+    {
+        return table_[symbol];
+    }
+
+    // The carrier sync symbol, and the alignment sequence which precedes
+    // every marker, are made of the corners of the constellation
+    static constexpr uint8_t carrier_sync_symbol(void)
+    {
+        return Corner(true, true);
+    }
+
+    static constexpr uint8_t alignment_symbol(uint32_t index)
+    {
+        constexpr uint8_t kSequence[4] = {
+            Corner(false, true),
+            Corner(false, false),
+            Corner(true, false),
+            Corner(true, true),
+        };
+
+        return kSequence[index % 4];
+    }
+
+protected:
+    static constexpr uint32_t kBitsPerAxis = bits_per_symbol / 2;
+    static constexpr uint32_t kMagnitudeBits = kBitsPerAxis - 1;
+    static constexpr uint32_t kMagnitudeMask = (1 << kMagnitudeBits) - 1;
+    static constexpr uint32_t kNumLevels = 1 << kMagnitudeBits;
+    static constexpr double kPi = 3.14159265358979323846;
+
+    static constexpr uint8_t Corner(bool negative_x, bool negative_y)
+    {
+        constexpr uint32_t kGray = kMagnitudeMask ^ (kMagnitudeMask >> 1);
+        return (negative_x << (bits_per_symbol - 1)) |
+            (negative_y << (bits_per_symbol - 2)) |
+            (kGray << kMagnitudeBits) | kGray;
+    }
+
+    int16_t table_[kNumSymbols][kSymbolDuration];
+};
+
+}
@@ -0,0 +1,586 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include "carrier_rejection_filter.h"
+#include "correlator.h"
+#include "demodulator.h"
+#include "one_pole.h"
+#include "pll.h"
+#include "util.h"
+
+namespace quadra
+{
+
+// Demodulates several independent signals, or lanes, at once. Each lane
+// follows the same algorithm as a Demodulator (results are identical up to
+// floating-point contraction, e.g. FMA), but the state of the signal chain
+// is stored in structure-of-arrays form, so that each stage is a loop
+// across the lanes which the compiler can vectorize. Acquisition and symbol
+// decisions, which happen only occasionally, are handled one lane at a time.
+template <uint32_t num_lanes,
+          uint32_t sample_rate,
+          uint32_t symbol_rate,
+          typename T = float,
+          uint32_t bits_per_symbol = 4>
+class MultiDemodulator
+{
+protected:
+    using Scalar = Demodulator<sample_rate, symbol_rate, T, bits_per_symbol>;
+    using State = typename Scalar::State;
+    using Vector = ComplexType<T>;
+    using PLL = PhaseLockedLoop<T>;
+
+    static_assert(num_lanes > 0 && num_lanes <= 32);
+    static_assert(!Scalar::kResample,
+        "Sample rate must be an integer multiple of the symbol rate");
+
+    static constexpr uint32_t kSymbolDuration = Scalar::kSymbolDuration;
+    using CRF = CarrierRejectionFilter<kSymbolDuration, T,
+        Scalar::kFilterSections>;
+    static constexpr uint32_t kNumSections = CRF::kNumSections;
+
+    // Filter state is indexed by [section][state][I or Q][lane], and the
+    // symbol history by [age][I or Q][lane]
+    State state_[num_lanes];
+    T hpf_[num_lanes];
+    T follower_[num_lanes];
+    T agc_gain_[num_lanes];
+    T pll_phase_[num_lanes];
+    T pll_prev_phase_[num_lanes];
+    T pll_step_[num_lanes];
+    T pll_error_[num_lanes];
+    T pll_accumulator_[num_lanes];
+    T crf_[kNumSections][2][2][num_lanes];
+    T history_[kSymbolDuration][2][num_lanes];
+    uint32_t history_head_;
+    T decision_phase_[num_lanes];
+    T decision_cos_[num_lanes];
+    T decision_sin_[num_lanes];
+    uint32_t skipped_samples_[num_lanes];
+    uint32_t carrier_sync_count_[num_lanes];
+    Correlator<T> correlator_[num_lanes];
+
+    // Masks of the lanes in each group of states, so that only the lanes
+    // which need individual attention are visited
+    uint32_t settling_;
+    uint32_t acquiring_;
+    uint32_t tracking_;
+    uint32_t errors_;
+
+    T hpf_factor_;
+    T follower_factor_;
+    T nominal_frequency_;
+
+    // Intermediate values passed between the stages of one sample. The
+    // flags are the same width as the samples so that they vectorize well.
+    T level_[num_lanes];
+    T sample_[num_lanes];
+    T v_[2][num_lanes];
+    T delay_[num_lanes];
+    int32_t demodulate_[num_lanes];
+    int32_t track_[num_lanes];
+    int32_t decide_[num_lanes];
+
+public:
+    void Init(void)
+    {
+        hpf_factor_ = OnePole<T>::Factor(Scalar::kHighpassFrequency);
+        follower_factor_ = OnePole<T>::Factor(Scalar::kFollowerFrequency);
+        nominal_frequency_ = float(1.0 / kSymbolDuration);
+        settling_ = 0;
+        acquiring_ = 0;
+        tracking_ = 0;
+        errors_ = 0;
+
+        for (uint32_t i = 0; i < kSymbolDuration; i++)
+        {
+            for (uint32_t lane = 0; lane < num_lanes; lane++)
+            {
+                history_[i][0][lane] = 0;
+                history_[i][1][lane] = 0;
+            }
+        }
+
+        history_head_ = 0;
+
+        for (uint32_t lane = 0; lane < num_lanes; lane++)
+        {
+            Reset(lane);
+        }
+    }
+
+    void Reset(uint32_t lane)
+    {
+        SetState(lane, Scalar::STATE_WAIT_TO_SETTLE);
+
+        hpf_[lane] = 0;
+        follower_[lane] = 0;
+        agc_gain_[lane] = 1;
+
+        pll_phase_[lane] = 0;
+        pll_prev_phase_[lane] = 0;
+        pll_step_[lane] = nominal_frequency_;
+        pll_error_[lane] = 0;
+        pll_accumulator_[lane] = 0;
+
+        for (uint32_t i = 0; i < kNumSections; i++)
+        {
+            for (uint32_t c = 0; c < 2; c++)
+            {
+                crf_[i][0][c][lane] = 0;
+                crf_[i][1][c][lane] = 0;
+            }
+        }
+
+        for (uint32_t i = 0; i < kSymbolDuration; i++)
+        {
+            history_[i][0][lane] = 0;
+            history_[i][1][lane] = 0;
+        }
+
+        correlator_[lane].Init();
+        SetDecisionPhase(lane, 0);
+        skipped_samples_[lane] = 0;
+        carrier_sync_count_[lane] = 0;
+    }
+
+    void BeginCarrierSync(uint32_t lane)
+    {
+        SetState(lane, Scalar::STATE_CARRIER_SYNC);
+        carrier_sync_count_[lane] = 0;
+    }
+
+    // Process one sample for each lane. Returns a mask of the lanes for
+    // which a symbol was decoded, and writes those symbols.
+    uint32_t Process(const T* samples, uint8_t* symbols)
+    {
+        FrontEnd(samples);
+        UpdateStates();
+        Mix();
+        uint32_t valid = Decide(symbols);
+        Step();
+        return valid;
+    }
+
+    bool error(uint32_t lane)
+    {
+        return errors_ & (1 << lane);
+    }
+
+    // Returns a mask of the lanes which are in the error state
+    uint32_t errors(void)
+    {
+        return errors_;
+    }
+
+    // Accessors for debug and simulation
+    uint32_t state(uint32_t lane)        {return state_[lane];}
+    T    pll_phase(uint32_t lane)      {return pll_phase_[lane];}
+    T    pll_step(uint32_t lane)       {return pll_step_[lane];}
+    T    decision_phase(uint32_t lane) {return decision_phase_[lane];}
+    T    signal_power(uint32_t lane)   {return follower_[lane];}
+    T    agc(uint32_t lane)            {return agc_gain_[lane];}
+
+protected:
+    // High-pass filter, level follower, and gain
+    void FrontEnd(const T* samples)
+    {
+        for (uint32_t lane = 0; lane < num_lanes; lane++)
+        {
+            T lp = hpf_[lane] + hpf_factor_ * (samples[lane] - hpf_[lane]);
+            T sample = samples[lane] - lp;
+            T level = follower_[lane] +
+                follower_factor_ * (Abs(sample) - follower_[lane]);
+            hpf_[lane] = lp;
+            follower_[lane] = level;
+            level_[lane] = level;
+            sample_[lane] = sample * agc_gain_[lane];
+        }
+    }
+
+    void SetDecisionPhase(uint32_t lane, T phase)
+    {
+        decision_phase_[lane] = phase;
+        SinCos(phase, decision_sin_[lane], decision_cos_[lane]);
+    }
+
+    void SetState(uint32_t lane, State state)
+    {
+        uint32_t bit = 1 << lane;
+        state_[lane] = state;
+        settling_ &= ~bit;
+        acquiring_ &= ~bit;
+        tracking_ &= ~bit;
+        errors_ &= ~bit;
+
+        if (state == Scalar::STATE_WAIT_TO_SETTLE ||
+            state == Scalar::STATE_SENSE_GAIN)
+        {
+            settling_ |= bit;
+        }
+        else if (state == Scalar::STATE_OK)
+        {
+            tracking_ |= bit;
+        }
+        else if (state == Scalar::STATE_ERROR)
+        {
+            errors_ |= bit;
+        }
+        else
+        {
+            acquiring_ |= bit;
+        }
+    }
+
+    // The states before carrier sync, and loss of signal. Lanes which begin
+    // carrier sync don't demodulate until the next sample.
+    void UpdateStates(void)
+    {
+        uint32_t demodulating = acquiring_ | tracking_;
+        uint32_t tracking = tracking_;
+
+        for (uint32_t mask = settling_; mask; mask &= mask - 1)
+        {
+            uint32_t lane = __builtin_ctz(mask);
+            T level = level_[lane];
+
+            if (skipped_samples_[lane] < Scalar::kSettlingTime)
+            {
+                skipped_samples_[lane]++;
+            }
+            else if (state_[lane] == Scalar::STATE_WAIT_TO_SETTLE)
+            {
+                if (level > Scalar::kLevelThreshold)
+                {
+                    skipped_samples_[lane] = 0;
+                    SetState(lane, Scalar::STATE_SENSE_GAIN);
+                }
+            }
+            else if (level > Scalar::kLevelThreshold)
+            {
+                agc_gain_[lane] = Scalar::InitialGain(level);
+                BeginCarrierSync(lane);
+            }
+            else
+            {
+                SetState(lane, Scalar::STATE_WAIT_TO_SETTLE);
+            }
+        }
+
+        uint32_t lost = 0;
+
+        for (uint32_t lane = 0; lane < num_lanes; lane++)
+        {
+            lost |= uint32_t(level_[lane] < Scalar::kLevelThreshold) << lane;
+        }
+
+        lost &= demodulating;
+        demodulating &= ~lost;
+        tracking &= ~lost;
+
+        for (; lost; lost &= lost - 1)
+        {
+            SetState(__builtin_ctz(lost), Scalar::STATE_ERROR);
+        }
+
+        for (uint32_t lane = 0; lane < num_lanes; lane++)
+        {
+            demodulate_[lane] = (demodulating >> lane) & 1;
+            track_[lane] = (tracking >> lane) & 1;
+        }
+    }
+
+    // Mix down to baseband and filter, and for the lanes which are tracking,
+    // update the PLL and detect the symbol decision points. Lanes which
+    // aren't demodulating compute the same values but leave their state
+    // unchanged.
+    void Mix(void)
+    {
+        uint32_t head = history_head_;
+
+        for (uint32_t lane = 0; lane < num_lanes; lane++)
+        {
+            bool demodulate = demodulate_[lane];
+            T phi = pll_phase_[lane];
+            T x = 2 * sample_[lane];
+            T sin_phi;
+            T cos_phi;
+            SinCos(phi, sin_phi, cos_phi);
+            T v[2] = {x * cos_phi, x * -sin_phi};
+
+            for (uint32_t i = 0; i < kNumSections; i++)
+            {
+                const auto& f = CRF::kCascade.section[i];
+
+                for (uint32_t c = 0; c < 2; c++)
+                {
+                    T s0 = crf_[i][0][c][lane];
+                    T s1 = crf_[i][1][c][lane];
+                    T y = f.b[0] * v[c] + s0;
+                    T next_s0 = f.b[1] * v[c] - f.a[0] * y + s1;
+                    T next_s1 = f.b[2] * v[c] - f.a[1] * y;
+                    crf_[i][0][c][lane] = demodulate ? next_s0 : s0;
+                    crf_[i][1][c][lane] = demodulate ? next_s1 : s1;
+                    v[c] = y;
+                }
+            }
+
+            // A lane's history is all zeros whenever it begins
+            // demodulating, as for a Demodulator which has just been reset
+            history_[head][0][lane] = demodulate ? v[0] : 0;
+            history_[head][1][lane] = demodulate ? v[1] : 0;
+            v_[0][lane] = v[0];
+            v_[1][lane] = v[1];
+
+            // The equivalent of Demodulator::Track
+            bool tracking = track_[lane];
+            T i_bar = Quantize(v[0]);
+            T q_bar = Quantize(v[1]);
+            T error = v[0] * q_bar - i_bar * v[1];
+            T decision_phase = decision_phase_[lane];
+            T cos_delta = cos_phi * decision_cos_[lane] +
+                sin_phi * decision_sin_[lane];
+            error *= T(0.5) * (1 + cos_delta);
+
+            T accumulator = pll_accumulator_[lane] + PLL::kKi * error;
+            accumulator = Clamp(accumulator,
+                -PLL::kWindupLimit, PLL::kWindupLimit);
+            T step = nominal_frequency_ *
+                (1 - PLL::kKp * error - accumulator);
+            step = Clamp<T>(step, 0, 1);
+
+            pll_error_[lane] = tracking ? error : pll_error_[lane];
+            pll_accumulator_[lane] =
+                tracking ? accumulator : pll_accumulator_[lane];
+            pll_step_[lane] = tracking ? step : pll_step_[lane];
+
+            T prev_phase = pll_prev_phase_[lane];
+            T wrapped = Wrap(phi - decision_phase);
+            decide_[lane] = tracking &
+                (wrapped < Wrap(prev_phase - decision_phase)) &
+                (phi != prev_phase);
+            delay_[lane] = wrapped / Wrap(phi - prev_phase);
+        }
+    }
+
+    uint32_t Decide(uint8_t* symbols)
+    {
+        uint32_t valid = 0;
+        uint32_t acquiring = 0;
+
+        for (uint32_t lane = 0; lane < num_lanes; lane++)
+        {
+            valid |= uint32_t(decide_[lane]) << lane;
+            acquiring |= uint32_t(demodulate_[lane] & !track_[lane]) << lane;
+        }
+
+        for (uint32_t mask = valid; mask; mask &= mask - 1)
+        {
+            uint32_t lane = __builtin_ctz(mask);
+            Vector v{v_[0][lane], v_[1][lane]};
+            symbols[lane] = DecideSymbol(lane, delay_[lane]);
+            AGCProcess(lane, v, Scalar::Quantize(v), Scalar::kAGCSlow);
+        }
+
+        for (; acquiring; acquiring &= acquiring - 1)
+        {
+            Acquire(__builtin_ctz(acquiring));
+        }
+
+        return valid;
+    }
+
+    void Step(void)
+    {
+        for (uint32_t lane = 0; lane < num_lanes; lane++)
+        {
+            bool demodulate = demodulate_[lane];
+            T phase = pll_phase_[lane];
+            T next_phase = FractionalPart(phase + pll_step_[lane]);
+            pll_prev_phase_[lane] =
+                demodulate ? phase : pll_prev_phase_[lane];
+            pll_phase_[lane] = demodulate ? next_phase : phase;
+        }
+
+        history_head_ = (history_head_ + 1) % kSymbolDuration;
+    }
+
+    // The equivalent of the acquisition states of Demodulator::Demodulate
+    void Acquire(uint32_t lane)
+    {
+        T phi = pll_phase_[lane];
+        Vector v{v_[0][lane], v_[1][lane]};
+        Vector v_bar = Scalar::Quantize(v);
+        State state = state_[lane];
+
+        if (state == Scalar::STATE_CARRIER_SYNC)
+        {
+            ProcessError(lane,
+                Scalar::CrossProduct(v, Scalar::kCarrierSyncVector));
+            auto decision = PhaseTrigger(lane, 0);
+
+            if (decision.has_value())
+            {
+                uint8_t symbol = DecideSymbol(lane, *decision);
+
+                if (symbol == Scalar::kCarrierSyncSymbol)
+                {
+                    AGCProcess(lane, v, Scalar::kCarrierSyncVector,
+                        Scalar::kAGCFast);
+
+                    if (++carrier_sync_count_[lane] ==
+                        Scalar::kCarrierSyncLength)
+                    {
+                        SetState(lane, Scalar::STATE_CARRIER_LOCK);
+                        correlator_[lane].Reset();
+                    }
+                }
+                else
+                {
+                    carrier_sync_count_[lane] = 0;
+                }
+            }
+        }
+        else if (state == Scalar::STATE_CARRIER_LOCK)
+        {
+            ProcessError(lane, Scalar::CrossProduct(v, v_bar));
+            auto decision0 = PhaseTrigger(lane, 0);
+            auto decision1 = PhaseTrigger(lane, 0.5);
+
+            if (decision0.has_value() || decision1.has_value())
+            {
+                T decision = decision0.value_or(*decision1);
+                uint8_t symbol = DecideSymbol(lane, decision);
+
+                AGCProcess(lane, v, Scalar::kCarrierSyncVector,
+                    Scalar::kAGCFast);
+                correlator_[lane].Push(phi, v);
+
+                if (symbol != Scalar::kCarrierSyncSymbol)
+                {
+                    SetState(lane, Scalar::STATE_ALIGN);
+                    SetDecisionPhase(lane, 0);
+                }
+            }
+        }
+        else if (state == Scalar::STATE_ALIGN)
+        {
+            ProcessError(lane, Scalar::CrossProduct(v, v_bar));
+            auto decision0 = PhaseTrigger(lane, 0);
+            auto decision1 = PhaseTrigger(lane, 0.5);
+
+            if (decision0.has_value() || decision1.has_value())
+            {
+                T decision = decision0.value_or(*decision1);
+                v = SampleSymbol(lane, decision);
+                auto decision_phase = correlator_[lane].Process(phi, v);
+
+                if (decision_phase.has_value())
+                {
+                    SetDecisionPhase(lane, *decision_phase);
+                    SetState(lane, Scalar::STATE_OK);
+                }
+            }
+        }
+    }
+
+    // The same as Demodulator::Quantize, but computes the levels instead of
+    // looking them up, which vectorizes better. They're exact either way.
+    static T Quantize(T sample)
+    {
+        constexpr int32_t kNumQuanta = Scalar::kNumQuanta;
+        int32_t index = Scalar::DecisionIndex(sample);
+        return T(2 * index + 1 - kNumQuanta) * T(1.0 / kNumQuanta);
+    }
+
+    // The equivalents of PhaseLockedLoop::ProcessError and phase_trigger
+    void ProcessError(uint32_t lane, T error)
+    {
+        pll_error_[lane] = error;
+
+        T accumulator = pll_accumulator_[lane] + PLL::kKi * error;
+        accumulator =
+            Clamp(accumulator, -PLL::kWindupLimit, PLL::kWindupLimit);
+        pll_accumulator_[lane] = accumulator;
+
+        T step = nominal_frequency_ * (1 - PLL::kKp * error - accumulator);
+        pll_step_[lane] = Clamp<T>(step, 0, 1);
+    }
+
+    std::optional<T> PhaseTrigger(uint32_t lane, T phi)
+    {
+        T phase = pll_phase_[lane];
+        T prev_phase = pll_prev_phase_[lane];
+
+        if (Wrap(phase - phi) < Wrap(prev_phase - phi) &&
+            phase != prev_phase)
+        {
+            return Wrap(phase - phi) / Wrap(phase - prev_phase);
+        }
+        else
+        {
+            return std::nullopt;
+        }
+    }
+
+    void AGCProcess(uint32_t lane, Vector v, Vector v_bar, T speed)
+    {
+        T i = v.real();
+        T q = v.imag();
+        T i_bar = v_bar.real();
+        T q_bar = v_bar.imag();
+        T error = (i * i + q * q) - (i_bar * i_bar + q_bar * q_bar);
+        agc_gain_[lane] -= speed * error;
+    }
+
+    Vector Tap(uint32_t lane, uint32_t age)
+    {
+        uint32_t i = (history_head_ + kSymbolDuration - age) % kSymbolDuration;
+        return {history_[i][0][lane], history_[i][1][lane]};
+    }
+
+    Vector SampleSymbol(uint32_t lane, T fractional_delay)
+    {
+        fractional_delay =
+            Clamp<T>(fractional_delay, 0, kSymbolDuration - 1.001);
+        int32_t i_late = static_cast<int32_t>(fractional_delay);
+        int32_t i_early = i_late + 1;
+        Vector early = Tap(lane, i_early);
+        Vector late = Tap(lane, i_late);
+        return Lerp(late, early, FractionalPart(fractional_delay));
+    }
+
+    uint8_t DecideSymbol(uint32_t lane, T fractional_delay)
+    {
+        Vector v = SampleSymbol(lane, fractional_delay);
+        int32_t i_index = Scalar::DecisionIndex(v.real());
+        int32_t q_index = Scalar::DecisionIndex(v.imag());
+        return Scalar::kSymbolTable.symbol[i_index][q_index];
+    }
+};
+
+}
@@ -29,17 +29,21 @@
 namespace quadra
 {
 
+template <typename T = float>
 class OnePole
 {
 protected:
+    template <uint32_t, uint32_t, uint32_t, typename, uint32_t>
+    friend class MultiDemodulator;
+
     static constexpr float Factor(float freq)
     {
         return 1 - std::exp(-2 * kPi * freq);
     }
 
-    float factor_;
-    float lp_;
-    float hp_;
+    T factor_;
+    T lp_;
+    T hp_;
 
 public:
     void Init(float normalized_frequency)
@@ -54,54 +58,56 @@ public:
         hp_ = 0;
     }
 
-    void Process(float in)
+    void Process(T in)
     {
         lp_ += factor_ * (in - lp_);
         hp_ = in - lp_;
     }
 
-    float lowpass(void)
+    T lowpass(void)
     {
         return lp_;
     }
 
-    float highpass(void)
+    T highpass(void)
     {
         return hp_;
     }
 };
 
-class OnePoleLowpass : public OnePole
+template <typename T = float>
+class OnePoleLowpass : public OnePole<T>
 {
 protected:
-    using super = OnePole;
+    using super = OnePole<T>;
 
 public:
-    float Process(float in)
+    T Process(T in)
     {
         super::Process(in);
         return super::lp_;
     }
 
-    float output(void)
+    T output(void)
     {
         return super::lp_;
     }
 };
 
-class OnePoleHighpass : public OnePole
+template <typename T = float>
+class OnePoleHighpass : public OnePole<T>
 {
 protected:
-    using super = OnePole;
+    using super = OnePole<T>;
 
 public:
-    float Process(float in)
+    T Process(T in)
     {
         super::Process(in);
         return super::hp_;
     }
 
-    float output(void)
+    T output(void)
     {
         return super::hp_;
     }
@@ -32,7 +32,9 @@
 namespace quadra
 {
 
-template <uint32_t packet_size>
+template <uint32_t packet_size,
+    typename Crc = Crc32,
+    uint32_t bits_per_symbol = 4>
 class Packet
 {
 protected:
@@ -43,10 +45,14 @@ protected:
         return (2 << num_parity_bits) - num_parity_bits - 1;
     }
 
+    static_assert(bits_per_symbol <= 8);
+
     uint32_t size_;
-    uint32_t byte_;
-    Crc32 crc_;
+    uint32_t bits_;
+    uint32_t num_bits_;
+    Crc crc_;
     uint32_t seed_;
+    uint32_t crc_correction_;
     HammingDecoder hamming_;
     Scrambler scrambler_;
 
@@ -63,9 +69,15 @@ protected:
         uint8_t bytes_[sizeof(PacketData)];
     };
 
+    static constexpr uint32_t kProtectedLength =
+        sizeof(PacketData) - sizeof(packet_.ecc);
+
     static_assert(
         kPacketDataLength * 8 <= max_data_bits(sizeof(packet_.ecc) * 8));
+    static_assert(kPacketDataLength % 4 == 0);
 
+    // The CRC and error syndrome are accumulated as bytes arrive so that
+    // completing a packet takes only a small, bounded amount of work.
     bool PushByte(uint8_t byte)
     {
         bool was_data_byte = (size_ < kPacketDataLength);
@@ -75,6 +87,17 @@ protected:
             bytes_[size_] = byte;
             size_++;
 
+            // Process the syndrome and payload CRC one word at a time
+            if (size_ <= kProtectedLength && size_ % 4 == 0)
+            {
+                hamming_.Process(&bytes_[size_ - 4], 4);
+
+                if (size_ <= kPacketDataLength)
+                {
+                    crc_.Process(&bytes_[size_ - 4], 4);
+                }
+            }
+
             if (size_ == sizeof(PacketData))
             {
                 Finalize();
@@ -90,11 +113,21 @@ protected:
             packet_.ecc = __builtin_bswap16(packet_.ecc);
         #endif
 
-        hamming_.Init(packet_.ecc);
-        hamming_.Process(bytes_, sizeof(PacketData) - sizeof(packet_.ecc));
+        uint32_t bit_pos;
 
-        crc_.Seed(seed_);
-        crc_.Process(packet_.payload, kPacketDataLength);
+        if (hamming_.Finalize(packet_.ecc, bit_pos) &&
+            bit_pos < kProtectedLength * 8)
+        {
+            bytes_[bit_pos / 8] ^= 1 << (bit_pos % 8);
+
+            // The payload CRC has already been calculated, so instead of
+            // recalculating it, account for the corrected bit.
+            if (bit_pos < kPacketDataLength * 8)
+            {
+                crc_correction_ =
+                    Crc32Polynomial::BitFlip(bit_pos, kPacketDataLength);
+            }
+        }
     }
 
 public:
@@ -108,19 +141,27 @@ public:
     void Reset(void)
     {
         size_ = 0;
-        byte_ = 1;
+        bits_ = 0;
+        num_bits_ = 0;
         scrambler_.Init();
+        crc_.Seed(seed_);
+        crc_correction_ = 0;
+        hamming_.Init();
     }
 
+    // Symbols are packed into bytes MSB first. If the packet length isn't a
+    // multiple of the symbol size, the last symbol is padded, and the
+    // padding is discarded when the packet is reset.
     bool WriteSymbol(uint8_t symbol)
     {
-        byte_ = (byte_ << 4) | symbol;
+        bits_ = (bits_ << bits_per_symbol) | symbol;
+        num_bits_ += bits_per_symbol;
         bool was_data_byte = false;
 
-        if (byte_ & 0x100)
+        if (num_bits_ >= 8)
         {
-            was_data_byte = PushByte(scrambler_.Process(byte_));
-            byte_ = 1;
+            num_bits_ -= 8;
+            was_data_byte = PushByte(scrambler_.Process(bits_ >> num_bits_));
         }
 
         return was_data_byte;
@@ -133,7 +174,7 @@ public:
 
     uint32_t calculated_crc(void)
     {
-        return crc_.crc();
+        return crc_.crc() ^ crc_correction_;
     }
 
     uint32_t expected_crc(void)
@@ -161,12 +202,21 @@ public:
     }
 };
 
-template <uint32_t block_size>
+// A block of data assembled from packets. If parity_packets is nonzero,
+// the data packets are followed by that many Reed-Solomon parity packets,
+// and up to that many packets which fail their CRC check may be recovered.
+template <uint32_t block_size, uint32_t packet_size,
+    uint32_t parity_packets = 0>
 class Block
 {
 protected:
+    static constexpr uint32_t kDataPackets = block_size / packet_size;
+    static constexpr uint32_t kNumPackets = kDataPackets + parity_packets;
+    static_assert(block_size % packet_size == 0);
+
     uint32_t data_[block_size / 4];
-    uint32_t size_;
+    uint32_t num_packets_;
+    ReedSolomonDecoder<kDataPackets, parity_packets, packet_size> fec_;
 
 public:
     void Init(void)
@@ -176,22 +226,71 @@ public:
 
     void Clear(void)
     {
-        size_ = 0;
+        num_packets_ = 0;
+        fec_.Init();
+    }
+
+    template <typename Crc, uint32_t bits_per_symbol>
+    void AppendPacket(Packet<packet_size, Crc, bits_per_symbol>& packet)
+    {
+        AppendPacket(packet, num_packets_);
     }
 
-    template <uint32_t packet_size>
-    void AppendPacket(Packet<packet_size>& packet)
+    // Append a packet at the given position in the block. Packets may
+    // arrive out of order (e.g. when received over several channels), but
+    // each position must be appended or erased only once.
+    template <typename Crc, uint32_t bits_per_symbol>
+    void AppendPacket(Packet<packet_size, Crc, bits_per_symbol>& packet,
+        uint32_t index)
     {
-        if (size_ <= block_size - packet_size)
+        if (index < kNumPackets && num_packets_ < kNumPackets)
         {
-            std::memcpy(&data_[size_ / 4], packet.data(), packet_size);
-            size_ += packet_size;
+            if (index < kDataPackets)
+            {
+                std::memcpy(&data_[index * packet_size / 4],
+                    packet.data(), packet_size);
+            }
+
+            fec_.Process(packet.data(), index);
+            num_packets_++;
+        }
+    }
+
+    // Append a packet which failed its CRC check. Returns false if the
+    // block can no longer be recovered.
+    bool ErasePacket(void)
+    {
+        return ErasePacket(num_packets_);
+    }
+
+    bool ErasePacket(uint32_t index)
+    {
+        if (index < kNumPackets && num_packets_ < kNumPackets &&
+            fec_.Erase(index))
+        {
+            num_packets_++;
+            return true;
         }
+
+        return false;
+    }
+
+    // Returns true once all of the data packets have been appended, i.e.
+    // if any further packets are parity packets
+    bool data_full(void)
+    {
+        return num_packets_ >= kDataPackets;
     }
 
     bool full(void)
     {
-        return size_ == block_size;
+        return num_packets_ == kNumPackets;
+    }
+
+    // Recover any erased packets. The block must be full.
+    void Correct(void)
+    {
+        fec_.Correct(reinterpret_cast<uint8_t*>(data_));
     }
 
     const uint32_t* data(void)
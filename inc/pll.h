@@ -30,15 +30,16 @@
 namespace quadra
 {
 
+template <typename T = float>
 class PhaseLockedLoop
 {
 protected:
-    float nominal_frequency_;
-    float step_;
-    float phase_;
-    float error_;
-    float accumulator_;
-    float prev_phase_;
+    T nominal_frequency_;
+    T step_;
+    T phase_;
+    T error_;
+    T accumulator_;
+    T prev_phase_;
 
 public:
     void Init(float normalized_frequency)
@@ -56,24 +57,24 @@ public:
         prev_phase_ = 0;
     }
 
-    float phase(void)
+    T phase(void)
     {
         return phase_;
     }
 
-    float step(void)
+    T step(void)
     {
         return step_;
     }
 
-    float error(void)
+    T error(void)
     {
         return error_;
     }
 
     // If our phase crossed the given threshold phi, return the calculated
     // fractional sample delay between the crossing and the current sample.
-    std::optional<float> phase_trigger(float phi)
+    std::optional<T> phase_trigger(T phi)
     {
         if (Wrap(phase_ - phi) < Wrap(prev_phase_ - phi) &&
             phase_ != prev_phase_)
@@ -86,22 +87,22 @@ public:
         }
     }
 
-    static constexpr float kKp = 0.02;
-    static constexpr float kKi = 200e-6;
-    static constexpr float kWindupLimit = 0.1;
+    static constexpr T kKp = 0.02;
+    static constexpr T kKi = 200e-6;
+    static constexpr T kWindupLimit = 0.1;
 
-    void ProcessError(float error)
+    void ProcessError(T error)
     {
         error_ = error;
 
         accumulator_ += kKi * error_;
         accumulator_ = Clamp(accumulator_, -kWindupLimit, kWindupLimit);
 
-        float p_error = kKp * error_;
-        float i_error = accumulator_;
+        T p_error = kKp * error_;
+        T i_error = accumulator_;
 
         step_ = nominal_frequency_ * (1 - p_error - i_error);
-        step_ = Clamp<float>(step_, 0, 1);
+        step_ = Clamp<T>(step_, 0, 1);
     }
 
     void Step(void)
@@ -0,0 +1,147 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstdint>
+
+namespace quadra
+{
+
+enum ProfileStage
+{
+    PROFILE_FRONT_END,      // High-pass filter, level follower, and AGC gain
+    PROFILE_MIXER,
+    PROFILE_CRF,
+    PROFILE_PHASE_DETECTOR, // Phase error, loop filter, and decision trigger
+    PROFILE_PLL,            // Oscillator step
+    PROFILE_CORRELATOR,
+    PROFILE_DECISION,       // Symbol decisions and AGC updates
+    PROFILE_SAMPLE,         // Total per sample in the demodulator
+    PROFILE_PACKET,         // Packet assembly, CRC, and Hamming correction
+    PROFILE_BLOCK,          // Reed-Solomon correction and decompression
+    PROFILE_FRAMING,        // Decoder total per symbol (or unpacked block)
+    PROFILE_NUM_STAGES,
+};
+
+// Discards all measurements. This is the default profiler, and compiles to
+// nothing.
+class NullProfiler
+{
+public:
+    void Init(void) {}
+    void Begin(void) {}
+    void Lap(ProfileStage) {}
+    void End(ProfileStage) {}
+};
+
+// Records the minimum, maximum, and mean duration of each stage. Times are
+// read from Clock::now(), which should return a free-running 32-bit counter
+// such as DWT->CYCCNT on a Cortex-M or the low half of rdtsc on x86.
+//
+// A measurement window is opened by Begin and divided by calls to Lap, each
+// of which charges the time since the previous call to the given stage.
+// End closes the window and charges all of it to the given total. A stage
+// which is lapped more than once in a window is measured as the sum, and a
+// stage which isn't reached isn't counted.
+template <typename Clock>
+class StageProfiler
+{
+public:
+    struct Statistics
+    {
+        uint32_t min;
+        uint32_t max;
+        uint32_t count;
+        uint64_t sum;
+
+        float mean(void) const
+        {
+            return count ? float(sum) / count : 0;
+        }
+    };
+
+    void Init(void)
+    {
+        for (uint32_t i = 0; i < PROFILE_NUM_STAGES; i++)
+        {
+            stats_[i].min = UINT32_MAX;
+            stats_[i].max = 0;
+            stats_[i].count = 0;
+            stats_[i].sum = 0;
+            elapsed_[i] = 0;
+        }
+
+        pending_ = 0;
+    }
+
+    void Begin(void)
+    {
+        start_ = Clock::now();
+        last_ = start_;
+    }
+
+    void Lap(ProfileStage stage)
+    {
+        uint32_t now = Clock::now();
+        elapsed_[stage] += now - last_;
+        pending_ |= 1 << stage;
+        last_ = now;
+    }
+
+    void End(ProfileStage total)
+    {
+        Record(total, Clock::now() - start_);
+
+        while (pending_)
+        {
+            uint32_t stage = __builtin_ctz(pending_);
+            pending_ &= pending_ - 1;
+            Record(stage, elapsed_[stage]);
+            elapsed_[stage] = 0;
+        }
+    }
+
+    const Statistics& stats(ProfileStage stage) const
+    {
+        return stats_[stage];
+    }
+
+protected:
+    Statistics stats_[PROFILE_NUM_STAGES];
+    uint32_t elapsed_[PROFILE_NUM_STAGES];
+    uint32_t pending_;
+    uint32_t start_;
+    uint32_t last_;
+
+    void Record(uint32_t stage, uint32_t duration)
+    {
+        Statistics& s = stats_[stage];
+        s.min = (duration < s.min) ? duration : s.min;
+        s.max = (duration > s.max) ? duration : s.max;
+        s.count++;
+        s.sum += duration;
+    }
+};
+
+}
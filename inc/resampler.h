@@ -0,0 +1,88 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstdint>
+
+namespace quadra
+{
+
+// Converts a stream of samples from input_rate to a higher output_rate by
+// cubic (Catmull-Rom) interpolation, evaluated in Farrow form. Each input
+// sample produces at most kMaxOutputs output samples.
+template <uint32_t input_rate, uint32_t output_rate, typename T = float>
+class Resampler
+{
+public:
+    static_assert(input_rate <= output_rate, "Only upsampling is supported");
+    static constexpr uint32_t kMaxOutputs =
+        (output_rate + input_rate - 1) / input_rate;
+
+    void Init(void)
+    {
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            x_[i] = 0;
+        }
+
+        t_ = 0;
+    }
+
+    // Push an input sample and write the resulting output samples to out.
+    // Returns the number of output samples written.
+    uint32_t Process(T in, T* out)
+    {
+        x_[0] = x_[1];
+        x_[1] = x_[2];
+        x_[2] = x_[3];
+        x_[3] = in;
+
+        // Output samples lie between x_[1] and x_[2]
+        T c0 = x_[1];
+        T c1 = T(0.5) * (x_[2] - x_[0]);
+        T c2 = x_[0] - T(2.5) * x_[1] + 2 * x_[2] - T(0.5) * x_[3];
+        T c3 = T(0.5) * (x_[3] - x_[0]) + T(1.5) * (x_[1] - x_[2]);
+
+        uint32_t n = 0;
+
+        while (t_ < 1)
+        {
+            out[n++] = ((c3 * t_ + c2) * t_ + c1) * t_ + c0;
+            t_ += kStep;
+        }
+
+        t_ -= 1;
+        return n;
+    }
+
+protected:
+    // The step is rounded, which amounts to a negligible error in the
+    // output rate.
+    static constexpr T kStep = static_cast<double>(input_rate) / output_rate;
+
+    T x_[4];
+    T t_;
+};
+
+}
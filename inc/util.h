@@ -23,6 +23,7 @@
 #pragma once
 
 #include <complex>
+#include <type_traits>
 
 namespace quadra
 {
@@ -31,6 +32,67 @@ static constexpr float kPi = 3.141592654;
 
 using Vector = std::complex<float>;
 
+// Minimal complex number for sample types other than float, double and long
+// double, for which std::complex is unspecified. Only the operations used by
+// the demodulator are provided.
+template <typename T>
+class Complex
+{
+protected:
+    T re_;
+    T im_;
+
+public:
+    Complex() = default;
+
+    template <typename U,
+        typename = std::enable_if_t<std::is_arithmetic_v<U>>>
+    constexpr Complex(U re) : re_(re), im_(0) {}
+
+    constexpr Complex(T re, T im) : re_(re), im_(im) {}
+
+    constexpr T real(void) const {return re_;}
+    constexpr T imag(void) const {return im_;}
+
+    constexpr Complex& operator+=(Complex b)
+    {
+        re_ += b.re_;
+        im_ += b.im_;
+        return *this;
+    }
+
+    constexpr Complex& operator-=(Complex b)
+    {
+        re_ -= b.re_;
+        im_ -= b.im_;
+        return *this;
+    }
+
+    friend constexpr Complex operator+(Complex a, Complex b)
+    {
+        return a += b;
+    }
+
+    friend constexpr Complex operator-(Complex a, Complex b)
+    {
+        return a -= b;
+    }
+
+    friend constexpr Complex operator*(Complex a, T b)
+    {
+        return {a.re_ * b, a.im_ * b};
+    }
+
+    friend constexpr Complex operator*(T a, Complex b)
+    {
+        return {a * b.re_, a * b.im_};
+    }
+};
+
+template <typename T>
+using ComplexType = std::conditional_t<std::is_floating_point_v<T>,
+    std::complex<T>, Complex<T>>;
+
 inline float Abs(float x)
 {
     return (x < 0) ? -x : x;
@@ -57,8 +119,8 @@ inline float Wrap(float x)
     return FractionalPart(1 + FractionalPart(x));
 }
 
-template <typename T>
-inline T Lerp(T a, T b, float t)
+template <typename T, typename U>
+inline T Lerp(T a, T b, U t)
 {
     return a + (b - a) * t;
 }
@@ -108,7 +170,7 @@ inline constexpr float kSineQuadrant[65] =
 
 inline float Sine(float t)
 {
-    uint32_t index = 256 * t;
+    uint32_t index = static_cast<int32_t>(256 * t);
     uint32_t quadrant = (index & 0xC0) >> 6;
     index &= 0x3F;
 
@@ -125,4 +187,58 @@ inline float Cosine(float t)
     return Sine(t + 0.25);
 }
 
+// A full cycle of the sine table, followed by a further quarter cycle so that
+// the cosine can be read from the same table at a fixed offset, plus a guard
+// entry for interpolation.
+template <typename T>
+struct SineCycleTable
+{
+    T value[256 + 64 + 1];
+};
+
+template <typename T>
+constexpr SineCycleTable<T> MakeSineCycleTable(void)
+{
+    SineCycleTable<T> table{};
+
+    for (uint32_t i = 0; i < 256 + 64 + 1; i++)
+    {
+        uint32_t quadrant = (i & 0xC0) >> 6;
+        uint32_t index = i & 0x3F;
+
+        if (quadrant & 1)
+        {
+            index = 0x40 - index;
+        }
+
+        float y = kSineQuadrant[index];
+        table.value[i] = (quadrant & 2) ? -y : y;
+    }
+
+    return table;
+}
+
+template <typename T>
+inline constexpr SineCycleTable<T> kSineCycle = MakeSineCycleTable<T>();
+
+// Quadrature oscillator output: the sine and cosine of the same phase,
+// computed together with linear interpolation between table entries. This
+// is far more accurate than Sine() and Cosine(), which truncate the phase to
+// a table entry, and costs less than calling both.
+//
+// The phase is truncated toward zero rather than rounded down, as this is on
+// the critical path of the PLL. Negative phases therefore extrapolate by up
+// to one entry, which is slightly less accurate but still correct.
+inline void SinCos(float t, float& sine, float& cosine)
+{
+    const auto& table = kSineCycle<float>.value;
+    float x = 256 * t;
+    int32_t integral = static_cast<int32_t>(x);
+    float f = x - integral;
+    uint32_t index = integral & 0xFF;
+
+    sine = Lerp(table[index], table[index + 1], f);
+    cosine = Lerp(table[index + 64], table[index + 65], f);
+}
+
 }
@@ -42,9 +42,9 @@ protected:
 public:
     void Init(void)
     {
-        delay_line_.Init(0);
-        sum_ = 0;
-        refresh_ = 0;
+        delay_line_.Init(T(0));
+        sum_ = T(0);
+        refresh_ = T(0);
         age_ = 0;
     }
 
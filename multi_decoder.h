@@ -0,0 +1,423 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstdint>
+#include "decoder.h"
+#include "inc/multi_demodulator.h"
+
+namespace quadra
+{
+
+// Decodes several independent signals at once, e.g. when verifying many
+// recordings or flashing many devices together. The lanes share a
+// MultiDemodulator, which advances all of them with one vectorized pass per
+// sample, while packets and blocks are handled separately for each lane.
+// The sample rate must be an integer multiple of the symbol rate.
+template <uint32_t num_lanes,
+          uint32_t sample_rate,
+          uint32_t symbol_rate,
+          uint32_t packet_size,
+          uint32_t block_size,
+          typename T = float,
+          typename Crc = Crc32,
+          uint32_t parity_packets = 0,
+          uint32_t window_bits = 0,
+          uint32_t bits_per_symbol = 4>
+class MultiDecoder
+{
+public:
+    void Init(uint32_t crc_seed)
+    {
+        demodulator_.Init();
+        active_ = 0;
+
+        for (uint32_t lane = 0; lane < num_lanes; lane++)
+        {
+            lanes_[lane].framer.Init(crc_seed);
+            lanes_[lane].block.Init();
+            Reset(lane);
+        }
+    }
+
+    void Reset(uint32_t lane)
+    {
+        Lane& l = lanes_[lane];
+        demodulator_.Reset(lane);
+        l.framer.Reset();
+        BeginSync(l);
+
+        l.block.Clear();
+        l.decompressor.Init();
+        l.bytes_received = 0;
+        l.total_size_bytes = 0;
+        l.error = ERROR_NONE;
+        l.result = RESULT_NONE;
+    }
+
+    // Process interleaved frames of one sample per lane from the given
+    // buffer. Processing stops after any frame in which a lane produces a
+    // result other than RESULT_NONE, and consumed is set to the number of
+    // frames processed. Returns a mask of the lanes which produced results,
+    // which may be retrieved with result(). A lane reports RESULT_END or
+    // RESULT_ERROR once, and then ignores its input until it is reset.
+    uint32_t Process(const T* buffer, uint32_t length, uint32_t& consumed)
+    {
+        consumed = 0;
+        uint32_t results = 0;
+
+        for (uint32_t lane = 0; lane < num_lanes; lane++)
+        {
+            Lane& l = lanes_[lane];
+            l.result = RESULT_NONE;
+
+            if (l.state == STATE_WRITE)
+            {
+                if (Unpack(l))
+                {
+                    l.result = RESULT_BLOCK_COMPLETE;
+                    results |= 1 << lane;
+                }
+                else
+                {
+                    Resume(lane);
+                }
+            }
+        }
+
+        uint32_t i = 0;
+
+        while (!results && i < length)
+        {
+            uint8_t symbols[num_lanes];
+            uint32_t valid =
+                demodulator_.Process(&buffer[i * num_lanes], symbols);
+            uint32_t errors = demodulator_.errors() & active_;
+            i++;
+
+            for (uint32_t lane = 0; errors; lane++, errors >>= 1)
+            {
+                if (errors & 1)
+                {
+                    ReportError(lanes_[lane], ERROR_SYNC);
+                    results |= 1 << lane;
+                }
+            }
+
+            valid &= active_;
+
+            for (uint32_t lane = 0; valid; lane++, valid >>= 1)
+            {
+                if (valid & 1)
+                {
+                    Lane& l = lanes_[lane];
+                    l.result = ProcessSymbol(l, symbols[lane]);
+
+                    if (l.result != RESULT_NONE)
+                    {
+                        results |= 1 << lane;
+                    }
+                }
+            }
+        }
+
+        consumed = i;
+        return results;
+    }
+
+    Result result(uint32_t lane)
+    {
+        return lanes_[lane].result;
+    }
+
+    Error error(uint32_t lane)
+    {
+        Lane& l = lanes_[lane];
+        return (l.state == STATE_ERROR) ? l.error : ERROR_NONE;
+    }
+
+    // Returns true once the lane has finished decoding or encountered an
+    // error
+    bool done(uint32_t lane)
+    {
+        return !(active_ & (1 << lane));
+    }
+
+    const uint32_t* block_data(uint32_t lane)
+    {
+        if constexpr (kCompressed)
+        {
+            return lanes_[lane].decompressor.data();
+        }
+        else
+        {
+            return lanes_[lane].block.data();
+        }
+    }
+
+    // Offset in bytes from the start of the image of the block returned by
+    // block_data. A sparse transfer omits blocks which are entirely fill
+    // bytes, as with Decoder.
+    uint32_t block_offset(uint32_t lane)
+    {
+        return lanes_[lane].bytes_received - block_size;
+    }
+
+    bool delta(uint32_t lane)
+    {
+        return lanes_[lane].framer.delta();
+    }
+
+    // Checks a lane's image against the checksum sent with a delta
+    // transfer, as with Decoder::VerifyImage
+    template <typename Read>
+    bool VerifyImage(uint32_t lane, Read&& read)
+    {
+        return lanes_[lane].framer.VerifyImage(read);
+    }
+
+    uint32_t total_size_bytes(uint32_t lane)
+    {
+        return lanes_[lane].total_size_bytes;
+    }
+
+    uint32_t bytes_received(uint32_t lane)
+    {
+        return lanes_[lane].bytes_received;
+    }
+
+    float progress(uint32_t lane)
+    {
+        Lane& l = lanes_[lane];
+
+        if (l.total_size_bytes == 0)
+        {
+            return 0;
+        }
+        else
+        {
+            return l.bytes_received * 1.0 / l.total_size_bytes;
+        }
+    }
+
+    // Accessors for debug and simulation
+    uint32_t state(uint32_t lane) {return lanes_[lane].state;}
+    uint32_t demodulator_state(uint32_t lane)
+        {return demodulator_.state(lane);}
+    T        signal_power(uint32_t lane)
+        {return demodulator_.signal_power(lane);}
+
+protected:
+    static_assert(block_size % packet_size == 0);
+    static_assert(packet_size % 4 == 0);
+    static constexpr bool kCompressed = (window_bits != 0);
+
+    enum State
+    {
+        STATE_SYNC,
+        STATE_DECODE,
+        STATE_WRITE,
+        STATE_END,
+        STATE_ERROR,
+    };
+
+    struct Lane
+    {
+        State state;
+        Error error;
+        Result result;
+        Framer<packet_size, block_size, Crc, bits_per_symbol> framer;
+        Block<block_size, packet_size, parity_packets> block;
+        BlockDecompressor<block_size, window_bits> decompressor;
+        uint32_t bytes_received;
+        uint32_t total_size_bytes;
+    };
+
+    MultiDemodulator<num_lanes, sample_rate, symbol_rate, T, bits_per_symbol>
+        demodulator_;
+    Lane lanes_[num_lanes];
+
+    // Mask of the lanes which are still decoding
+    uint32_t active_;
+
+    uint32_t Mask(Lane& l)
+    {
+        return 1 << (&l - lanes_);
+    }
+
+    void Resume(uint32_t lane)
+    {
+        lanes_[lane].block.Clear();
+        demodulator_.BeginCarrierSync(lane);
+        BeginSync(lanes_[lane]);
+    }
+
+    Result ProcessSymbol(Lane& l, uint8_t symbol)
+    {
+        if (l.state == STATE_SYNC)
+        {
+            return Frame(l, symbol);
+        }
+        else if (l.state == STATE_DECODE)
+        {
+            return Decode(l, symbol);
+        }
+
+        return RESULT_NONE;
+    }
+
+    bool Unpack(Lane& l)
+    {
+        if (kCompressed && l.bytes_received < l.total_size_bytes &&
+            l.decompressor.Process())
+        {
+            l.bytes_received += block_size;
+            return true;
+        }
+
+        return false;
+    }
+
+    void BeginSync(Lane& l)
+    {
+        l.state = STATE_SYNC;
+        l.framer.BeginSync();
+        active_ |= Mask(l);
+    }
+
+    // Receive the markers, metadata and block addresses of one lane
+    Result Frame(Lane& l, uint8_t symbol)
+    {
+        FrameEvent event = l.framer.Process(symbol);
+
+        if (event == FRAME_BLOCK && kCompressed && l.framer.sparse())
+        {
+            // Sparse transfers can't be compressed
+            return ReportError(l, ERROR_SYNC);
+        }
+        else if (event == FRAME_METADATA)
+        {
+            l.total_size_bytes = l.framer.total_size_bytes();
+        }
+        else if (event == FRAME_ADDRESS)
+        {
+            if (!l.framer.address_valid(l.bytes_received))
+            {
+                return ReportError(l, ERROR_LENGTH);
+            }
+
+            l.bytes_received = l.framer.address_offset();
+        }
+        else if (event == FRAME_END)
+        {
+            // Any blocks omitted from the end of a sparse transfer are
+            // blank, so they count as received
+            if (l.framer.sparse() && l.bytes_received <= l.total_size_bytes)
+            {
+                l.bytes_received = l.total_size_bytes;
+            }
+
+            if (l.bytes_received == l.total_size_bytes)
+            {
+                l.state = STATE_END;
+                active_ &= ~Mask(l);
+                return RESULT_END;
+            }
+            else
+            {
+                return ReportError(l, ERROR_LENGTH);
+            }
+        }
+        else if (event == FRAME_ERROR_SYNC)
+        {
+            return ReportError(l, ERROR_SYNC);
+        }
+        else if (event == FRAME_ERROR_CRC)
+        {
+            return ReportError(l, ERROR_CRC);
+        }
+
+        if (l.framer.in_block())
+        {
+            l.state = STATE_DECODE;
+        }
+
+        return RESULT_NONE;
+    }
+
+    Result Decode(Lane& l, uint8_t symbol)
+    {
+        auto& packet = l.framer.packet();
+        bool is_parity = l.block.data_full();
+
+        if (packet.WriteSymbol(symbol) && !is_parity && !kCompressed)
+        {
+            l.bytes_received++;
+        }
+
+        if (!packet.full())
+        {
+            return RESULT_NONE;
+        }
+
+        if (packet.valid())
+        {
+            l.block.AppendPacket(packet);
+        }
+        else if (!l.block.ErasePacket())
+        {
+            return ReportError(l, ERROR_CRC);
+        }
+
+        packet.Reset();
+
+        if (l.block.full())
+        {
+            l.block.Correct();
+            l.state = STATE_WRITE;
+
+            if (kCompressed)
+            {
+                l.decompressor.Feed(l.block.data());
+                return Unpack(l) ? RESULT_BLOCK_COMPLETE :
+                    RESULT_PACKET_COMPLETE;
+            }
+
+            return RESULT_BLOCK_COMPLETE;
+        }
+
+        return RESULT_PACKET_COMPLETE;
+    }
+
+    Result ReportError(Lane& l, Error error)
+    {
+        l.state = STATE_ERROR;
+        l.error = error;
+        l.result = RESULT_ERROR;
+        active_ &= ~Mask(l);
+        return RESULT_ERROR;
+    }
+};
+
+}
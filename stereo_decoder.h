@@ -0,0 +1,486 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include "decoder.h"
+
+namespace quadra
+{
+
+// Decodes a transfer which is split across the two channels of a stereo
+// signal. Each channel has its own demodulator, and the packets of each block
+// alternate between the channels, starting with the left. Both channels carry
+// the same markers and metadata.
+template <uint32_t sample_rate,
+          uint32_t symbol_rate,
+          uint32_t packet_size,
+          uint32_t block_size,
+          uint32_t fifo_capacity = 256,
+          typename T = float,
+          typename Crc = Crc32,
+          uint32_t parity_packets = 0,
+          uint32_t window_bits = 0,
+          uint32_t bits_per_symbol = 4>
+class StereoDecoder
+{
+public:
+    static constexpr uint32_t kNumChannels = 2;
+
+    void Init(uint32_t crc_seed)
+    {
+        for (uint32_t c = 0; c < kNumChannels; c++)
+        {
+            channels_[c].demodulator.Init();
+            channels_[c].framer.Init(crc_seed);
+        }
+
+        block_.Init();
+        Reset();
+    }
+
+    void Reset(void)
+    {
+        for (uint32_t c = 0; c < kNumChannels; c++)
+        {
+            Channel& channel = channels_[c];
+            channel.demodulator.Reset();
+            channel.framer.Reset();
+            BeginSync(channel);
+        }
+
+        state_ = STATE_DECODE;
+        block_.Clear();
+        decompressor_.Init();
+        bytes_received_ = 0;
+        total_size_bytes_ = 0;
+
+        abort_.store(false, std::memory_order_relaxed);
+        error_ = ERROR_NONE;
+
+        FlushSamples();
+    }
+
+    // Push interleaved frames of left and right samples
+    void Push(T* buffer, uint32_t length)
+    {
+        if (!samples_.Push(buffer, length * kNumChannels))
+        {
+            overflow_.store(true, std::memory_order_release);
+        }
+    }
+
+    void Push(T left, T right)
+    {
+        T frame[kNumChannels] = {left, right};
+        Push(frame, 1);
+    }
+
+    Result Process(void)
+    {
+        if (state_ == STATE_WRITE)
+        {
+            if (Unpack())
+            {
+                return RESULT_BLOCK_COMPLETE;
+            }
+
+            Resume();
+            FlushSamples();
+        }
+        else if (state_ == STATE_END)
+        {
+            return RESULT_END;
+        }
+
+        Result result = RESULT_NONE;
+        const T* buffer;
+        uint32_t length;
+
+        // Frames are always pushed whole and the FIFO capacity is even, so
+        // a contiguous span never ends partway through a frame.
+        while (result == RESULT_NONE && (length = samples_.Peek(buffer)))
+        {
+            uint32_t consumed;
+            result = ProcessFrames(buffer, length / kNumChannels, consumed);
+            samples_.Consume(consumed * kNumChannels);
+        }
+
+        return result;
+    }
+
+    // Process interleaved frames directly from the given buffer rather than
+    // from the input FIFO. Length and consumed are counted in frames.
+    Result Process(const T* buffer, uint32_t length, uint32_t& consumed)
+    {
+        consumed = 0;
+
+        if (state_ == STATE_WRITE)
+        {
+            if (Unpack())
+            {
+                return RESULT_BLOCK_COMPLETE;
+            }
+
+            Resume();
+        }
+        else if (state_ == STATE_END)
+        {
+            return RESULT_END;
+        }
+
+        return ProcessFrames(buffer, length, consumed);
+    }
+
+    void Abort(void)
+    {
+        abort_.store(true, std::memory_order_relaxed);
+    }
+
+    Error error(void)
+    {
+        return (state_ == STATE_ERROR) ? error_ : ERROR_NONE;
+    }
+
+    const uint32_t* block_data(void)
+    {
+        if constexpr (kCompressed)
+        {
+            return decompressor_.data();
+        }
+        else
+        {
+            return block_.data();
+        }
+    }
+
+    // Offset in bytes from the start of the image of the block returned by
+    // block_data
+    uint32_t block_offset(void)
+    {
+        return bytes_received_ - block_size;
+    }
+
+    uint32_t total_size_bytes(void)
+    {
+        return total_size_bytes_;
+    }
+
+    uint32_t bytes_received(void)
+    {
+        return bytes_received_;
+    }
+
+    float progress(void)
+    {
+        if (total_size_bytes_ == 0)
+        {
+            return 0;
+        }
+        else
+        {
+            return bytes_received_ * 1.0 / total_size_bytes_;
+        }
+    }
+
+    // Accessors for debug and simulation
+    uint32_t state(void) {return state_;}
+    uint32_t channel_state(uint32_t c)     {return channels_[c].state;}
+    uint32_t demodulator_state(uint32_t c)
+        {return channels_[c].demodulator.state();}
+    T        signal_power(uint32_t c)
+        {return channels_[c].demodulator.signal_power();}
+    uint32_t samples_available(void) {return samples_.available();}
+
+protected:
+    static constexpr uint32_t kDataPackets = block_size / packet_size;
+    static constexpr uint32_t kNumPackets = kDataPackets + parity_packets;
+    static_assert(block_size % packet_size == 0);
+    static_assert(kNumPackets >= kNumChannels,
+        "Each channel must carry at least one packet per block");
+    static_assert(packet_size % 4 == 0);
+    static constexpr bool kCompressed = (window_bits != 0);
+
+    enum State
+    {
+        STATE_DECODE,
+        STATE_WRITE,
+        STATE_END,
+        STATE_ERROR,
+    };
+
+    enum ChannelState
+    {
+        CHANNEL_SYNC,
+        CHANNEL_DECODE,
+        CHANNEL_IDLE,
+        CHANNEL_END,
+    };
+
+    // A channel is idle once it has received all of its packets of the
+    // current block, until the block is complete. Each channel carries its
+    // own copy of the markers and metadata.
+    struct Channel
+    {
+        Demodulator<sample_rate, symbol_rate, T, bits_per_symbol> demodulator;
+        Framer<packet_size, block_size, Crc, bits_per_symbol> framer;
+        ChannelState state;
+        uint32_t packet_index;
+    };
+
+    Fifo<T, fifo_capacity * kNumChannels> samples_;
+    Channel channels_[kNumChannels];
+    State state_;
+    Error error_;
+    Block<block_size, packet_size, parity_packets> block_;
+    BlockDecompressor<block_size, window_bits> decompressor_;
+    std::atomic_bool abort_;
+    std::atomic_bool overflow_;
+    uint32_t bytes_received_;
+    uint32_t total_size_bytes_;
+
+    void FlushSamples(void)
+    {
+        samples_.Flush();
+        overflow_.store(false, std::memory_order_release);
+    }
+
+    void Resume(void)
+    {
+        block_.Clear();
+        state_ = STATE_DECODE;
+
+        for (uint32_t c = 0; c < kNumChannels; c++)
+        {
+            channels_[c].demodulator.BeginCarrierSync();
+            BeginSync(channels_[c]);
+        }
+    }
+
+    Result ProcessFrames(const T* buffer, uint32_t length,
+        uint32_t& consumed)
+    {
+        consumed = 0;
+
+        if (length == 0)
+        {
+            return RESULT_NONE;
+        }
+
+        if (abort_.load(std::memory_order_relaxed))
+        {
+            return ReportError(ERROR_ABORT);
+        }
+        else if (overflow_.load(std::memory_order_relaxed))
+        {
+            return ReportError(ERROR_OVERFLOW);
+        }
+
+        Result result = RESULT_NONE;
+        uint32_t i = 0;
+
+        while (result == RESULT_NONE && i < length)
+        {
+            const T* frame = &buffer[i * kNumChannels];
+            i++;
+
+            // Both samples of a frame are always processed. If both channels
+            // produce a result, the more significant one is returned.
+            for (uint32_t c = 0; c < kNumChannels; c++)
+            {
+                Result r = ProcessSample(channels_[c], frame[c]);
+                result = (r > result) ? r : result;
+            }
+        }
+
+        consumed = i;
+        return result;
+    }
+
+    Result ProcessSample(Channel& channel, T sample)
+    {
+        if (channel.state == CHANNEL_END)
+        {
+            return RESULT_NONE;
+        }
+
+        uint8_t symbol;
+        bool symbol_valid = channel.demodulator.Process(symbol, sample);
+
+        if (state_ == STATE_ERROR)
+        {
+            return RESULT_ERROR;
+        }
+        else if (channel.demodulator.error())
+        {
+            return ReportError(ERROR_SYNC);
+        }
+        else if (!symbol_valid || state_ != STATE_DECODE)
+        {
+            return RESULT_NONE;
+        }
+        else if (channel.state == CHANNEL_SYNC)
+        {
+            return Frame(channel, symbol);
+        }
+        else if (channel.state == CHANNEL_DECODE)
+        {
+            return Decode(channel, symbol);
+        }
+
+        return RESULT_NONE;
+    }
+
+    bool Unpack(void)
+    {
+        if (kCompressed && bytes_received_ < total_size_bytes_ &&
+            decompressor_.Process())
+        {
+            bytes_received_ += block_size;
+            return true;
+        }
+
+        return false;
+    }
+
+    void BeginSync(Channel& channel)
+    {
+        channel.state = CHANNEL_SYNC;
+        channel.framer.BeginSync();
+        channel.packet_index = &channel - channels_;
+    }
+
+    // Receive the markers and metadata of one channel
+    Result Frame(Channel& channel, uint8_t symbol)
+    {
+        FrameEvent event = channel.framer.Process(symbol);
+
+        if (event == FRAME_BLOCK && channel.framer.sparse())
+        {
+            // Stereo transfers can't be sparse
+            return ReportError(ERROR_SYNC);
+        }
+        else if (event == FRAME_METADATA)
+        {
+            total_size_bytes_ = channel.framer.total_size_bytes();
+        }
+        else if (event == FRAME_END)
+        {
+            channel.state = CHANNEL_END;
+
+            for (uint32_t c = 0; c < kNumChannels; c++)
+            {
+                if (channels_[c].state != CHANNEL_END)
+                {
+                    return RESULT_NONE;
+                }
+            }
+
+            if (bytes_received_ == total_size_bytes_)
+            {
+                state_ = STATE_END;
+                return RESULT_END;
+            }
+            else
+            {
+                return ReportError(ERROR_LENGTH);
+            }
+        }
+        else if (event == FRAME_ERROR_SYNC)
+        {
+            return ReportError(ERROR_SYNC);
+        }
+        else if (event == FRAME_ERROR_CRC)
+        {
+            return ReportError(ERROR_CRC);
+        }
+
+        if (channel.framer.in_block())
+        {
+            channel.state = CHANNEL_DECODE;
+        }
+
+        return RESULT_NONE;
+    }
+
+    Result Decode(Channel& channel, uint8_t symbol)
+    {
+        auto& packet = channel.framer.packet();
+        bool is_parity = (channel.packet_index >= kDataPackets);
+
+        if (packet.WriteSymbol(symbol) && !is_parity && !kCompressed)
+        {
+            bytes_received_++;
+        }
+
+        if (!packet.full())
+        {
+            return RESULT_NONE;
+        }
+
+        if (packet.valid())
+        {
+            block_.AppendPacket(packet, channel.packet_index);
+        }
+        else if (!block_.ErasePacket(channel.packet_index))
+        {
+            return ReportError(ERROR_CRC);
+        }
+
+        packet.Reset();
+        channel.packet_index += kNumChannels;
+
+        if (channel.packet_index >= kNumPackets)
+        {
+            channel.state = CHANNEL_IDLE;
+        }
+
+        if (block_.full())
+        {
+            block_.Correct();
+            state_ = STATE_WRITE;
+
+            if (kCompressed)
+            {
+                decompressor_.Feed(block_.data());
+                return Unpack() ? RESULT_BLOCK_COMPLETE :
+                    RESULT_PACKET_COMPLETE;
+            }
+
+            return RESULT_BLOCK_COMPLETE;
+        }
+
+        return RESULT_PACKET_COMPLETE;
+    }
+
+    Result ReportError(Error error)
+    {
+        state_ = STATE_ERROR;
+        error_ = error;
+        return RESULT_ERROR;
+    }
+};
+
+}
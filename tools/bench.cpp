@@ -0,0 +1,574 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+// Micro-benchmarks for each stage of the decoder, for evaluating
+// optimizations and catching regressions. Each stage is run over a fixed
+// workload several times, and the fastest run is reported in nanoseconds
+// per sample, symbol, or byte. Build with the flags used for the target
+// under test where possible, e.g.
+//
+//   g++ -std=c++17 -O2 -Iquadra quadra/tools/bench.cpp -o bench
+//   ./bench [filter]
+//
+// Only the benchmarks whose names contain filter are run.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "inc/carrier_rejection_filter.h"
+#include "inc/correlator.h"
+#include "inc/crc32.h"
+#include "inc/demodulator.h"
+#include "inc/error_correction.h"
+#include "inc/fifo.h"
+#include "inc/packet.h"
+#include "inc/pll.h"
+#include "inc/scrambler.h"
+#include "inc/util.h"
+
+namespace
+{
+
+using namespace quadra;
+using Vector = std::complex<float>;
+
+constexpr uint32_t kRepetitions = 7;
+constexpr uint32_t kNumSamples = 1 << 16;
+constexpr uint32_t kNumBytes = 1 << 16;
+constexpr uint32_t kSymbolRate = 4800;
+
+const char* filter_ = "";
+
+// Keeps the compiler from optimizing away a result
+template <typename T>
+inline void Escape(T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// Returns false if the benchmark was skipped by the filter
+template <typename Function>
+bool Run(const char* name, const char* param, const char* unit,
+    uint64_t num_units, Function&& function)
+{
+    char label[64];
+    std::snprintf(label, sizeof(label), "%s %s", name, param);
+
+    if (!std::strstr(label, filter_))
+    {
+        return false;
+    }
+
+    double best = INFINITY;
+
+    for (uint32_t i = 0; i < kRepetitions; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+
+    std::printf("%-48s %9.3f ns/%s\n", label, best / num_units, unit);
+    return true;
+}
+
+std::vector<float> RandomFloats(uint32_t length, float min, float max)
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> distribution(min, max);
+    std::vector<float> values(length);
+
+    for (float& value : values)
+    {
+        value = distribution(rng);
+    }
+
+    return values;
+}
+
+std::vector<uint8_t> RandomBytes(uint32_t length)
+{
+    std::mt19937 rng(2);
+    std::vector<uint8_t> bytes(length);
+
+    for (uint8_t& byte : bytes)
+    {
+        byte = rng();
+    }
+
+    return bytes;
+}
+
+void BenchSine(void)
+{
+    auto phase = RandomFloats(kNumSamples, 0, 1);
+    float sum;
+
+    Run("Sine", "", "call", kNumSamples, [&]
+    {
+        sum = 0;
+
+        for (float t : phase)
+        {
+            sum += Sine(t);
+        }
+
+        Escape(sum);
+    });
+
+    Run("Cosine", "", "call", kNumSamples, [&]
+    {
+        sum = 0;
+
+        for (float t : phase)
+        {
+            sum += Cosine(t);
+        }
+
+        Escape(sum);
+    });
+
+    Run("SinCos", "", "call", kNumSamples, [&]
+    {
+        sum = 0;
+
+        for (float t : phase)
+        {
+            float sine;
+            float cosine;
+            SinCos(t, sine, cosine);
+            sum += sine + cosine;
+        }
+
+        Escape(sum);
+    });
+}
+
+template <uint32_t symbol_duration>
+void BenchFilter(void)
+{
+    // As configured by Demodulator
+    constexpr uint32_t kSections = (symbol_duration > 4) ? 2 : 1;
+    static CarrierRejectionFilter<symbol_duration, float, kSections> crf;
+    static Vector buffer[kNumSamples];
+    auto x = RandomFloats(2 * kNumSamples, -1, 1);
+    char param[16];
+    std::snprintf(param, sizeof(param), "duration=%u", symbol_duration);
+    crf.Init();
+
+    Run("CarrierRejectionFilter::Process", param, "sample", kNumSamples, [&]
+    {
+        Vector out;
+
+        for (uint32_t i = 0; i < kNumSamples; i++)
+        {
+            out = crf.Process({x[2 * i], x[2 * i + 1]});
+            Escape(out);
+        }
+    });
+
+    Run("CarrierRejectionFilter::Process[]", param, "sample", kNumSamples, [&]
+    {
+        for (uint32_t i = 0; i < kNumSamples; i++)
+        {
+            buffer[i] = {x[2 * i], x[2 * i + 1]};
+        }
+
+        crf.Process(buffer, buffer, kNumSamples);
+        Escape(buffer);
+    });
+}
+
+void BenchPll(void)
+{
+    PhaseLockedLoop<float> pll;
+    auto error = RandomFloats(kNumSamples, -0.1, 0.1);
+    pll.Init(0.1);
+
+    Run("PhaseLockedLoop", "", "sample", kNumSamples, [&]
+    {
+        uint32_t triggers = 0;
+
+        for (float e : error)
+        {
+            pll.ProcessError(e);
+            pll.Step();
+            triggers += pll.phase_trigger(0.5).has_value();
+        }
+
+        Escape(triggers);
+    });
+}
+
+void BenchCorrelator(void)
+{
+    Correlator<float> correlator;
+    auto x = RandomFloats(2 * kNumSamples, -1, 1);
+    correlator.Init();
+
+    Run("Correlator::Process", "", "sample", kNumSamples, [&]
+    {
+        uint32_t peaks = 0;
+        float phase = 0;
+
+        for (uint32_t i = 0; i < kNumSamples; i++)
+        {
+            phase = FractionalPart(phase + 0.1f);
+            peaks += correlator.Process(phase, {x[2 * i], x[2 * i + 1]})
+                .has_value();
+        }
+
+        Escape(peaks);
+    });
+}
+
+void BenchFifo(void)
+{
+    static Fifo<float, 256> fifo;
+    auto x = RandomFloats(kNumSamples, -1, 1);
+    fifo.Init();
+
+    // The usual pattern of one sample pushed from an interrupt and
+    // consumed soon after
+    Run("Fifo::Push/Pop", "", "sample", kNumSamples, [&]
+    {
+        float sum = 0;
+
+        for (float& sample : x)
+        {
+            float y = 0;
+            fifo.Push(sample);
+            fifo.Pop(y);
+            sum += y;
+        }
+
+        Escape(sum);
+    });
+
+    Run("Fifo::Push/Peek/Consume", "length=32", "sample", kNumSamples, [&]
+    {
+        float sum = 0;
+
+        for (uint32_t i = 0; i < kNumSamples; i += 32)
+        {
+            fifo.Push(&x[i], 32);
+            const float* items;
+            uint32_t length;
+
+            while ((length = fifo.Peek(items)))
+            {
+                for (uint32_t j = 0; j < length; j++)
+                {
+                    sum += items[j];
+                }
+
+                fifo.Consume(length);
+            }
+        }
+
+        Escape(sum);
+    });
+}
+
+void BenchExternalFifo(void)
+{
+    static ExternalFifo<float> fifo;
+    static float buffer[2 * 32];
+    auto x = RandomFloats(kNumSamples, -1, 1);
+    fifo.Attach(buffer, 2 * 32);
+
+    // Samples are written in place in halves, as by DMA, and read directly
+    // from the buffer
+    Run("ExternalFifo::Commit/Peek/Consume", "length=32", "sample",
+        kNumSamples, [&]
+    {
+        float sum = 0;
+
+        for (uint32_t i = 0; i < kNumSamples; i += 32)
+        {
+            std::memcpy(&buffer[i % 64], &x[i], 32 * sizeof(float));
+            fifo.Commit(32);
+            const float* first;
+            const float* second;
+            uint32_t first_length;
+            uint32_t length = fifo.Peek(first, first_length, second);
+
+            for (uint32_t j = 0; j < length; j++)
+            {
+                sum += (j < first_length) ? first[j] : second[j - first_length];
+            }
+
+            fifo.Consume(length);
+        }
+
+        Escape(sum);
+    });
+}
+
+void BenchScrambler(void)
+{
+    Scrambler scrambler;
+    auto bytes = RandomBytes(kNumBytes);
+    scrambler.Init();
+
+    Run("Scrambler::Process", "", "byte", kNumBytes, [&]
+    {
+        uint8_t x = 0;
+
+        for (uint8_t byte : bytes)
+        {
+            x ^= scrambler.Process(byte);
+        }
+
+        Escape(x);
+    });
+}
+
+template <typename Crc, uint32_t packet_size>
+void BenchCrc(const char* name)
+{
+    Crc crc;
+    auto bytes = RandomBytes(kNumBytes);
+    char param[24];
+    std::snprintf(param, sizeof(param), "size=%u", packet_size);
+    crc.Init();
+
+    // Packets accumulate their CRC four bytes at a time
+    Run(name, param, "byte", kNumBytes, [&]
+    {
+        for (uint32_t i = 0; i < kNumBytes; i += packet_size)
+        {
+            crc.Seed(0);
+
+            for (uint32_t j = 0; j < packet_size; j += 4)
+            {
+                crc.Process(&bytes[i + j], 4);
+            }
+
+            uint32_t result = crc.crc();
+            Escape(result);
+        }
+    });
+
+    Run(name, (std::string(param) + " whole").c_str(), "byte", kNumBytes, [&]
+    {
+        for (uint32_t i = 0; i < kNumBytes; i += packet_size)
+        {
+            crc.Seed(0);
+            uint32_t result = crc.Process(&bytes[i], packet_size);
+            Escape(result);
+        }
+    });
+}
+
+template <uint32_t packet_size>
+void BenchHamming(void)
+{
+    HammingDecoder hamming;
+    auto bytes = RandomBytes(kNumBytes);
+    char param[16];
+    std::snprintf(param, sizeof(param), "size=%u", packet_size);
+
+    Run("HammingDecoder::Process", param, "byte", kNumBytes, [&]
+    {
+        for (uint32_t i = 0; i < kNumBytes; i += packet_size)
+        {
+            hamming.Init();
+
+            for (uint32_t j = 0; j < packet_size; j += 4)
+            {
+                hamming.Process(&bytes[i + j], 4);
+            }
+
+            uint32_t bit_pos = 0;
+            bool corrected = hamming.Finalize(0x1234, bit_pos);
+            Escape(corrected);
+            Escape(bit_pos);
+        }
+    });
+}
+
+template <uint32_t packet_size>
+void BenchPacket(void)
+{
+    static Packet<packet_size> packet;
+    auto bytes = RandomBytes(kNumBytes);
+    char param[16];
+    std::snprintf(param, sizeof(param), "size=%u", packet_size);
+    packet.Init(0);
+
+    Run("Packet::WriteSymbol", param, "byte", kNumBytes, [&]
+    {
+        uint32_t num_valid = 0;
+
+        for (uint8_t byte : bytes)
+        {
+            packet.WriteSymbol(byte >> 4);
+            packet.WriteSymbol(byte & 0xF);
+
+            if (packet.full())
+            {
+                num_valid += packet.valid();
+                packet.Reset();
+            }
+        }
+
+        Escape(num_valid);
+    });
+}
+
+template <uint32_t... packet_sizes>
+void BenchFraming(std::integer_sequence<uint32_t, packet_sizes...>)
+{
+    (BenchCrc<Crc32, packet_sizes>("Crc32::Process"), ...);
+    (BenchCrc<SoftwareCrc32<1>, packet_sizes>("SoftwareCrc32<1>::Process"),
+        ...);
+    (BenchCrc<SoftwareCrc32<4>, packet_sizes>("SoftwareCrc32<4>::Process"),
+        ...);
+    (BenchCrc<SoftwareCrc32<8>, packet_sizes>("SoftwareCrc32<8>::Process"),
+        ...);
+    (BenchHamming<packet_sizes>(), ...);
+    (BenchPacket<packet_sizes>(), ...);
+}
+
+// Synthesizes a 16-QAM signal like the encoder's: a carrier sync tone, the
+// alignment sequence, and then random symbols.
+std::vector<float> Modulate(uint32_t symbol_duration, uint32_t num_symbols)
+{
+    static constexpr int32_t kLevels[2] = {1, 3};
+    auto symbol = [](uint32_t s)
+    {
+        int32_t x = kLevels[s & 1];
+        int32_t y = kLevels[(s >> 1) & 1];
+        return Vector((s & 8) ? -x : x, (s & 4) ? -y : y);
+    };
+
+    constexpr uint8_t kCorner[4] = {0x7, 0x3, 0xB, 0xF};
+    std::vector<uint8_t> symbols(kSymbolRate, 0xF);
+
+    for (uint32_t i = 0; i < 16; i++)
+    {
+        symbols.push_back(kCorner[i % 4]);
+    }
+
+    std::mt19937 rng(3);
+
+    for (uint32_t i = 0; i < num_symbols; i++)
+    {
+        symbols.push_back(rng() & 0xF);
+    }
+
+    std::vector<float> signal;
+
+    for (uint8_t s : symbols)
+    {
+        Vector v = symbol(s);
+
+        for (uint32_t i = 0; i < symbol_duration; i++)
+        {
+            double phase = 2 * M_PI * i / symbol_duration;
+            signal.push_back((v.real() * std::cos(phase) -
+                v.imag() * std::sin(phase)) / (3 * std::sqrt(2.0)));
+        }
+    }
+
+    return signal;
+}
+
+template <uint32_t symbol_duration>
+void BenchDemodulator(void)
+{
+    static Demodulator<symbol_duration * kSymbolRate, kSymbolRate> demodulator;
+    constexpr uint32_t kNumSymbols = 8192;
+    auto signal = Modulate(symbol_duration, kNumSymbols);
+    char param[16];
+    std::snprintf(param, sizeof(param), "duration=%u", symbol_duration);
+    uint32_t num_symbols = 0;
+
+    bool ran = Run("Demodulator::Process", param, "sample", signal.size(), [&]
+    {
+        demodulator.Init();
+        num_symbols = 0;
+        const float* buffer = signal.data();
+        uint32_t length = signal.size();
+
+        while (length && !demodulator.error())
+        {
+            uint8_t symbol;
+            uint32_t consumed;
+            num_symbols += demodulator.Process(symbol, buffer, length,
+                consumed);
+            buffer += consumed;
+            length -= consumed;
+        }
+    });
+
+    // Make sure that the steady state was actually measured
+    if (ran && num_symbols < kNumSymbols * 0.99)
+    {
+        std::fprintf(stderr, "warning: decoded only %u of %u symbols\n",
+            num_symbols, kNumSymbols);
+    }
+}
+
+template <uint32_t... durations>
+void BenchSignalChain(std::integer_sequence<uint32_t, durations...>)
+{
+    (BenchFilter<durations + 4>(), ...);
+    (BenchDemodulator<durations + 4>(), ...);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+    {
+        filter_ = argv[1];
+    }
+
+    BenchSine();
+    BenchPll();
+    BenchCorrelator();
+    BenchFifo();
+    BenchExternalFifo();
+    BenchScrambler();
+
+    // Every supported symbol duration, from 4 to 16 samples
+    BenchSignalChain(std::make_integer_sequence<uint32_t, 13>());
+
+    BenchFraming(std::integer_sequence<uint32_t,
+        4, 16, 64, 128, 256, 512, 1024, 2048, 4096>());
+
+    return 0;
+}
@@ -0,0 +1,264 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+// Host-side tool which decodes a WAV file produced by encoder.py and writes
+// the received blocks to a binary image. The input is memory-mapped when it
+// is a regular file, and otherwise read as a stream (e.g. from a pipe), so
+// the encoder's output can be piped straight in:
+//
+//   python3 quadra/encoder.py ... -o - | ./decode -e 0x420ACAB -o out.bin -
+//
+// See wav_decode.h for the decoder configuration. The sample rate is set
+// separately with QUADRA_SAMPLE_RATE.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "wav_decode.h"
+
+#ifndef QUADRA_SAMPLE_RATE
+#define QUADRA_SAMPLE_RATE 48000
+#endif
+
+namespace
+{
+
+using namespace quadra::tools;
+
+constexpr uint32_t kSampleRate = QUADRA_SAMPLE_RATE;
+
+MonoDecoder<kSampleRate> mono_decoder_;
+StereoDecoder<kSampleRate> stereo_decoder_;
+
+void Usage(const char* name)
+{
+    std::fprintf(stderr,
+        "usage: %s [-a address] [-b base] [-e seed] [-f byte] "
+        "[-o output.bin] [-q]\n"
+        "       input.wav\n"
+        "\n"
+        "Decodes a WAV file (or '-' for stdin) and writes the received\n"
+        "blocks to the output file (or '-' for stdout).\n"
+        "\n"
+        "  -a addr  start address of a hex base image (default: its\n"
+        "           lowest address)\n"
+        "  -b path  base image (bin or hex) for a delta transfer, from\n"
+        "           which the unchanged pages are taken\n"
+        "  -e seed  CRC seed, as passed to the encoder (default 0)\n"
+        "  -f byte  fill byte for blocks omitted from a sparse transfer\n"
+        "           (default 0xFF)\n"
+        "  -o path  output image\n"
+        "  -q       print nothing unless decoding fails\n"
+        "\n"
+        "Compiled for %u Hz, %u baud, %u-byte packets, %u-byte blocks,\n"
+        "%u parity packets, %u window bits, %u bits per symbol.\n",
+        name, QUADRA_SAMPLE_RATE, QUADRA_SYMBOL_RATE, QUADRA_PACKET_SIZE,
+        QUADRA_BLOCK_SIZE, QUADRA_PARITY_PACKETS, QUADRA_WINDOW_BITS,
+        QUADRA_BITS_PER_SYMBOL);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t seed = 0;
+    ImageOptions image_options;
+    const char* base_path = nullptr;
+    const char* output_path = nullptr;
+    bool quiet = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:b:e:f:o:qh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b': base_path = optarg; break;
+            case 'e': seed = std::strtoul(optarg, nullptr, 0); break;
+            case 'a': image_options.start_address =
+                          std::strtoul(optarg, nullptr, 0);
+                      image_options.has_start_address = true;
+                      break;
+            case 'f': image_options.fill_byte =
+                          std::strtoul(optarg, nullptr, 0);
+                      break;
+            case 'o': output_path = optarg; break;
+            case 'q': quiet = true; break;
+            default: Usage(argv[0]); return 2;
+        }
+    }
+
+    if (optind != argc - 1)
+    {
+        Usage(argv[0]);
+        return 2;
+    }
+
+    std::vector<uint8_t> base;
+
+    std::string message;
+
+    if (base_path && !LoadImage(base_path, image_options, base, message))
+    {
+        std::fprintf(stderr, "error: base image: %s\n", message.c_str());
+        return 2;
+    }
+
+    const char* input_path = argv[optind];
+    Input input;
+    Format format;
+
+    if (!input.Open(input_path))
+    {
+        std::fprintf(stderr, "error: %s: %s\n", input_path,
+            std::strerror(errno));
+        return 2;
+    }
+
+    if (const char* message = ReadHeader(input, format))
+    {
+        std::fprintf(stderr, "error: %s: %s\n", input_path, message);
+        input.Close();
+        return 2;
+    }
+
+    if (format.sample_rate != kSampleRate)
+    {
+        std::fprintf(stderr, "error: %s: expected %u Hz, got %u Hz\n",
+            input_path, kSampleRate, format.sample_rate);
+        input.Close();
+        return 2;
+    }
+
+    FILE* output = nullptr;
+
+    if (output_path)
+    {
+        output = std::strcmp(output_path, "-") ?
+            std::fopen(output_path, "wb") : stdout;
+
+        if (!output)
+        {
+            std::fprintf(stderr, "error: %s: %s\n", output_path,
+                std::strerror(errno));
+            input.Close();
+            return 2;
+        }
+    }
+
+    // The image is kept so that a delta transfer's checksum can be verified
+    // once it has ended. Blocks omitted from a delta transfer are unchanged
+    // from the base image, and those omitted from a sparse one are blank.
+    std::vector<uint8_t> image;
+
+    auto write_block = [&](const uint8_t* data, uint32_t size)
+    {
+        size_t offset = image.size();
+
+        if (data)
+        {
+            image.insert(image.end(), data, data + size);
+        }
+        else
+        {
+            for (size_t i = offset; i < offset + size; i++)
+            {
+                image.push_back((i < base.size()) ?
+                    base[i] : image_options.fill_byte);
+            }
+        }
+
+        if (output)
+        {
+            std::fwrite(image.data() + offset, 1, size, output);
+        }
+    };
+
+    auto read_image = [&](uint32_t offset, uint32_t)
+    {
+        return image.data() + offset;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    Stats stats;
+    bool verified = true;
+
+    if (format.num_channels == 1)
+    {
+        mono_decoder_.Init(seed);
+        stats = Decode(mono_decoder_, input, format, write_block);
+        verified = (stats.result != quadra::RESULT_END) ||
+            mono_decoder_.VerifyImage(read_image);
+    }
+    else
+    {
+        stereo_decoder_.Init(seed);
+        stats = Decode(stereo_decoder_, input, format, write_block);
+    }
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    bool mapped = input.mapped();
+    input.Close();
+
+    if (output && output != stdout)
+    {
+        std::fclose(output);
+    }
+
+    double duration = double(stats.frames) / kSampleRate;
+    double rtf = (duration > 0) ? elapsed.count() / duration : 0;
+
+    if (stats.result == quadra::RESULT_ERROR)
+    {
+        std::fprintf(stderr, "error: %s error at %.3f s\n",
+            ErrorName(stats.error), duration);
+    }
+    else if (stats.result != quadra::RESULT_END)
+    {
+        std::fprintf(stderr, "error: input ended at %.3f s before the end "
+            "of the transfer\n", duration);
+    }
+    else if (!verified)
+    {
+        std::fprintf(stderr, "error: image doesn't match the checksum of the "
+            "delta transfer\n");
+    }
+
+    bool success = (stats.result == quadra::RESULT_END) && verified;
+
+    if (!quiet || !success)
+    {
+        std::fprintf(stderr, "%llu bytes from %.3f s of %s audio "
+            "in %.3f s (RTF %.5f, %.0fx real time%s)\n",
+            static_cast<unsigned long long>(stats.bytes_received), duration,
+            (format.num_channels == 1) ? "mono" : "stereo",
+            elapsed.count(), rtf, (rtf > 0) ? 1 / rtf : 0,
+            mapped ? ", mapped" : "");
+    }
+
+    return success ? 0 : 1;
+}
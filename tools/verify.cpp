@@ -0,0 +1,583 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+// Host-side tool which decodes many WAV files produced by encoder.py in
+// parallel and checks each against the bin or hex file it was encoded from.
+// Files are given as a list of WAV files and directories, each WAV file
+// being checked against the .bin or .hex file with the same name, or as a
+// manifest with one "wav-file seed [reference-file]" line per file. A JSON
+// summary is written to stdout.
+//
+// See wav_decode.h for the decoder configuration. Files may use any of the
+// sample rates listed in QUADRA_SAMPLE_RATES, each of which is compiled in.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "wav_decode.h"
+
+#ifndef QUADRA_SAMPLE_RATES
+#define QUADRA_SAMPLE_RATES 48000, 96000
+#endif
+
+#define QUADRA_STRINGIFY_(...) #__VA_ARGS__
+#define QUADRA_STRINGIFY(...) QUADRA_STRINGIFY_(__VA_ARGS__)
+
+namespace
+{
+
+using namespace quadra::tools;
+
+enum Status
+{
+    STATUS_PASS,
+    STATUS_MISMATCH,
+    STATUS_DECODE_ERROR,
+    STATUS_TRUNCATED,
+    STATUS_INPUT_ERROR,
+    STATUS_REFERENCE_ERROR,
+};
+
+const char* StatusName(Status status)
+{
+    switch (status)
+    {
+        case STATUS_PASS:            return "pass";
+        case STATUS_MISMATCH:        return "mismatch";
+        case STATUS_DECODE_ERROR:    return "decode_error";
+        case STATUS_TRUNCATED:       return "truncated";
+        case STATUS_INPUT_ERROR:     return "input_error";
+        default:                     return "reference_error";
+    }
+}
+
+struct Task
+{
+    std::string wav_path;
+    std::string reference_path;
+    uint32_t seed;
+    uint64_t size;
+
+    Status status;
+    std::string message;
+    Format format;
+    Stats stats;
+    int64_t mismatch_offset;
+    double seconds;
+};
+
+// Decodes with a decoder instantiated for the given sample rate, or returns
+// false if the WAV file's sample rate isn't one of those compiled in.
+template <uint32_t sample_rate, typename BlockWriter>
+bool DecodeAt(Input& input, Task& task, BlockWriter& write_block)
+{
+    if (task.format.sample_rate != sample_rate)
+    {
+        return false;
+    }
+
+    if (task.format.num_channels == 1)
+    {
+        auto decoder = std::make_unique<MonoDecoder<sample_rate>>();
+        decoder->Init(task.seed);
+        task.stats = Decode(*decoder, input, task.format, write_block);
+    }
+    else
+    {
+        auto decoder = std::make_unique<StereoDecoder<sample_rate>>();
+        decoder->Init(task.seed);
+        task.stats = Decode(*decoder, input, task.format, write_block);
+    }
+
+    return true;
+}
+
+template <uint32_t... sample_rates, typename BlockWriter>
+bool DecodeAny(Input& input, Task& task, BlockWriter& write_block)
+{
+    return (DecodeAt<sample_rates>(input, task, write_block) || ...);
+}
+
+void Verify(Task& task, const ImageOptions& options)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> reference;
+    Input input;
+
+    task.stats = {0, 0, quadra::RESULT_NONE, quadra::ERROR_NONE};
+    task.format = {0, 0, 0};
+    task.mismatch_offset = -1;
+
+    if (!LoadImage(task.reference_path, options, reference, task.message))
+    {
+        task.status = STATUS_REFERENCE_ERROR;
+    }
+    else if (!input.Open(task.wav_path.c_str()))
+    {
+        task.status = STATUS_INPUT_ERROR;
+        task.message = std::strerror(errno);
+    }
+    else
+    {
+        // Blocks are compared as they arrive; the image is padded to a
+        // whole block with the fill byte, as are any blocks omitted from a
+        // sparse transfer.
+        uint64_t offset = 0;
+
+        auto write_block = [&](const uint8_t* data, uint32_t size)
+        {
+            for (uint32_t i = 0; i < size && task.mismatch_offset < 0; i++)
+            {
+                uint8_t expected = (offset + i < reference.size()) ?
+                    reference[offset + i] : options.fill_byte;
+                uint8_t actual = data ? data[i] : options.fill_byte;
+
+                if (actual != expected)
+                {
+                    task.mismatch_offset = offset + i;
+                }
+            }
+
+            offset += size;
+        };
+
+        if (const char* message = ReadHeader(input, task.format))
+        {
+            task.status = STATUS_INPUT_ERROR;
+            task.message = message;
+        }
+        else if (!DecodeAny<QUADRA_SAMPLE_RATES>(input, task, write_block))
+        {
+            task.status = STATUS_INPUT_ERROR;
+            task.message = "unsupported sample rate " +
+                std::to_string(task.format.sample_rate);
+        }
+        else if (task.stats.result == quadra::RESULT_ERROR)
+        {
+            task.status = STATUS_DECODE_ERROR;
+        }
+        else if (task.stats.result != quadra::RESULT_END)
+        {
+            task.status = STATUS_TRUNCATED;
+        }
+        else if (task.mismatch_offset >= 0)
+        {
+            task.status = STATUS_MISMATCH;
+        }
+        else if (offset < reference.size())
+        {
+            task.status = STATUS_MISMATCH;
+            task.mismatch_offset = offset;
+            task.message = "image is shorter than the reference";
+        }
+        else
+        {
+            task.status = STATUS_PASS;
+        }
+
+        input.Close();
+    }
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    task.seconds = elapsed.count();
+}
+
+// Each worker owns a queue of tasks, taking from its front and, when it
+// runs dry, stealing from the back of the others' queues. Tasks are dealt
+// out longest first, so that the stragglers at the end are short ones.
+class WorkerPool
+{
+public:
+    void Run(std::vector<Task>& tasks, const ImageOptions& options,
+        uint32_t num_threads)
+    {
+        std::vector<uint32_t> order(tasks.size());
+
+        for (uint32_t i = 0; i < order.size(); i++)
+        {
+            order[i] = i;
+        }
+
+        std::stable_sort(order.begin(), order.end(),
+            [&](uint32_t a, uint32_t b) {return tasks[a].size > tasks[b].size;});
+
+        queues_ = std::vector<Queue>(num_threads);
+
+        for (uint32_t i = 0; i < order.size(); i++)
+        {
+            queues_[i % num_threads].tasks.push_back(order[i]);
+        }
+
+        std::vector<std::thread> threads;
+
+        for (uint32_t id = 0; id < num_threads; id++)
+        {
+            threads.emplace_back([this, id, &tasks, &options]
+            {
+                uint32_t index;
+
+                while (Next(id, index))
+                {
+                    Verify(tasks[index], options);
+                }
+            });
+        }
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+protected:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<uint32_t> tasks;
+    };
+
+    std::vector<Queue> queues_;
+
+    bool Next(uint32_t id, uint32_t& index)
+    {
+        uint32_t num_queues = queues_.size();
+
+        for (uint32_t i = 0; i < num_queues; i++)
+        {
+            Queue& queue = queues_[(id + i) % num_queues];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+
+            if (!queue.tasks.empty())
+            {
+                if (i == 0)
+                {
+                    index = queue.tasks.front();
+                    queue.tasks.pop_front();
+                }
+                else
+                {
+                    index = queue.tasks.back();
+                    queue.tasks.pop_back();
+                }
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+void AddWav(std::vector<Task>& tasks, const std::filesystem::path& path,
+    uint32_t seed, std::string reference_path)
+{
+    if (reference_path.empty())
+    {
+        std::filesystem::path bin = path;
+        std::filesystem::path hex = path;
+        bin.replace_extension(".bin");
+        hex.replace_extension(".hex");
+        reference_path = (std::filesystem::exists(hex) &&
+            !std::filesystem::exists(bin)) ? hex.string() : bin.string();
+    }
+
+    std::error_code error;
+    uint64_t size = std::filesystem::file_size(path, error);
+    Task task = {};
+    task.wav_path = path.string();
+    task.reference_path = reference_path;
+    task.seed = seed;
+    task.size = error ? 0 : size;
+    tasks.push_back(task);
+}
+
+bool AddPath(std::vector<Task>& tasks, const char* arg, uint32_t seed)
+{
+    std::filesystem::path path(arg);
+    std::error_code error;
+
+    if (std::filesystem::is_directory(path, error))
+    {
+        std::vector<std::filesystem::path> wavs;
+
+        for (auto& entry : std::filesystem::directory_iterator(path, error))
+        {
+            if (entry.path().extension() == ".wav")
+            {
+                wavs.push_back(entry.path());
+            }
+        }
+
+        std::sort(wavs.begin(), wavs.end());
+
+        for (auto& wav : wavs)
+        {
+            AddWav(tasks, wav, seed, "");
+        }
+
+        return !error;
+    }
+
+    AddWav(tasks, path, seed, "");
+    return true;
+}
+
+bool AddManifest(std::vector<Task>& tasks, const char* path)
+{
+    std::ifstream file(path);
+
+    if (!file)
+    {
+        return false;
+    }
+
+    std::string line;
+
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        char wav[4096];
+        char seed[64];
+        char reference[4096] = "";
+        int n = std::sscanf(line.c_str(), "%4095s %63s %4095s",
+            wav, seed, reference);
+
+        if (n >= 2)
+        {
+            AddWav(tasks, wav, std::strtoul(seed, nullptr, 0), reference);
+        }
+        else if (n == 1)
+        {
+            std::fprintf(stderr, "error: %s: no seed for %s\n", path, wav);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::string Quote(const std::string& s)
+{
+    std::string quoted = "\"";
+
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+        {
+            quoted += '\\';
+            quoted += c;
+        }
+        else if (uint8_t(c) < 0x20)
+        {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
+        }
+        else
+        {
+            quoted += c;
+        }
+    }
+
+    return quoted + "\"";
+}
+
+void WriteSummary(FILE* out, const std::vector<Task>& tasks,
+    uint32_t num_threads, double wall_seconds)
+{
+    uint32_t num_passed = 0;
+    double audio_seconds = 0;
+    double decode_seconds = 0;
+    uint64_t wav_bytes = 0;
+
+    std::fprintf(out, "{\n  \"files\": [");
+
+    for (uint32_t i = 0; i < tasks.size(); i++)
+    {
+        const Task& task = tasks[i];
+        double duration = task.format.sample_rate ?
+            double(task.stats.frames) / task.format.sample_rate : 0;
+
+        num_passed += (task.status == STATUS_PASS);
+        audio_seconds += duration;
+        decode_seconds += task.seconds;
+        wav_bytes += task.size;
+
+        std::fprintf(out, "%s\n    {\"wav\": %s, \"reference\": %s, "
+            "\"seed\": %u, \"sample_rate\": %u, \"channels\": %u, "
+            "\"status\": \"%s\", \"error\": \"%s\", \"error_code\": %d, "
+            "\"bytes\": %llu, \"mismatch_offset\": %lld, "
+            "\"audio_seconds\": %.3f, \"decode_seconds\": %.4f, "
+            "\"message\": %s}",
+            i ? "," : "", Quote(task.wav_path).c_str(),
+            Quote(task.reference_path).c_str(), task.seed,
+            task.format.sample_rate, task.format.num_channels,
+            StatusName(task.status), ErrorName(task.stats.error),
+            task.stats.error,
+            static_cast<unsigned long long>(task.stats.bytes_received),
+            static_cast<long long>(task.mismatch_offset), duration,
+            task.seconds, Quote(task.message).c_str());
+    }
+
+    std::fprintf(out, "\n  ],\n  \"summary\": {\"files\": %zu, "
+        "\"passed\": %u, \"failed\": %zu, \"threads\": %u, "
+        "\"wall_seconds\": %.3f, \"decode_seconds\": %.3f, "
+        "\"audio_seconds\": %.3f, \"files_per_second\": %.2f, "
+        "\"wav_megabytes_per_second\": %.2f, \"real_time_factor\": %.6f}\n}\n",
+        tasks.size(), num_passed, tasks.size() - num_passed, num_threads,
+        wall_seconds, decode_seconds, audio_seconds,
+        tasks.size() / wall_seconds, wav_bytes / wall_seconds / 1e6,
+        audio_seconds ? wall_seconds / audio_seconds : 0);
+}
+
+void Usage(const char* name)
+{
+    std::fprintf(stderr,
+        "usage: %s [options] (wav-file | directory)...\n"
+        "       %s [options] -m manifest\n"
+        "\n"
+        "Decodes WAV files in parallel and compares each with the bin or\n"
+        "hex file it was encoded from. A JSON summary is written to stdout.\n"
+        "\n"
+        "  -e seed     CRC seed for files given on the command line\n"
+        "  -m path     manifest of \"wav-file seed [reference-file]\" lines\n"
+        "  -j threads  number of worker threads (default: all cores)\n"
+        "  -a address  start address of hex references, as passed to the\n"
+        "              encoder (default: lowest address in the file)\n"
+        "  -f byte     fill byte, as passed to the encoder (default 0xFF)\n"
+        "  -o path     write the summary to a file instead\n"
+        "\n"
+        "Compiled for sample rates %s, %u baud, %u-byte packets,\n"
+        "%u-byte blocks, %u parity packets, %u window bits, "
+        "%u bits per symbol.\n",
+        name, name, QUADRA_STRINGIFY(QUADRA_SAMPLE_RATES),
+        QUADRA_SYMBOL_RATE, QUADRA_PACKET_SIZE, QUADRA_BLOCK_SIZE,
+        QUADRA_PARITY_PACKETS, QUADRA_WINDOW_BITS, QUADRA_BITS_PER_SYMBOL);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    ImageOptions options;
+    std::vector<Task> tasks;
+    uint32_t seed = 0;
+    uint32_t num_threads = std::thread::hardware_concurrency();
+    const char* manifest_path = nullptr;
+    const char* output_path = nullptr;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "e:m:j:a:f:o:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'e': seed = std::strtoul(optarg, nullptr, 0); break;
+            case 'm': manifest_path = optarg; break;
+            case 'j': num_threads = std::strtoul(optarg, nullptr, 0); break;
+            case 'f': options.fill_byte = std::strtoul(optarg, nullptr, 0);
+                      break;
+            case 'a': options.start_address =
+                          std::strtoul(optarg, nullptr, 0);
+                      options.has_start_address = true;
+                      break;
+            case 'o': output_path = optarg; break;
+            default: Usage(argv[0]); return 2;
+        }
+    }
+
+    if (manifest_path && !AddManifest(tasks, manifest_path))
+    {
+        std::fprintf(stderr, "error: can't read manifest %s\n",
+            manifest_path);
+        return 2;
+    }
+
+    for (int i = optind; i < argc; i++)
+    {
+        if (!AddPath(tasks, argv[i], seed))
+        {
+            std::fprintf(stderr, "error: can't read directory %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    if (tasks.empty())
+    {
+        Usage(argv[0]);
+        return 2;
+    }
+
+    num_threads = std::max(num_threads, 1u);
+    num_threads = std::min<uint32_t>(num_threads, tasks.size());
+
+    FILE* out = output_path ? std::fopen(output_path, "w") : stdout;
+
+    if (!out)
+    {
+        std::fprintf(stderr, "error: %s: %s\n", output_path,
+            std::strerror(errno));
+        return 2;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    WorkerPool pool;
+    pool.Run(tasks, options, num_threads);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    WriteSummary(out, tasks, num_threads, elapsed.count());
+
+    if (out != stdout)
+    {
+        std::fclose(out);
+    }
+
+    uint32_t num_failed = 0;
+
+    for (const Task& task : tasks)
+    {
+        if (task.status != STATUS_PASS)
+        {
+            num_failed++;
+            std::fprintf(stderr, "FAIL %s: %s%s%s\n", task.wav_path.c_str(),
+                StatusName(task.status),
+                task.message.empty() ? "" : ": ", task.message.c_str());
+        }
+    }
+
+    std::fprintf(stderr, "%zu files, %u failed, %.3f s with %u threads\n",
+        tasks.size(), num_failed, elapsed.count(), num_threads);
+
+    return num_failed ? 1 : 0;
+}
@@ -0,0 +1,605 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+// Helpers shared by the host tools for reading WAV files produced by
+// encoder.py and feeding them to a decoder. The decoder configuration is
+// fixed at compile time and must match the encoder's options; override the
+// defaults below with -D.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "decoder.h"
+#include "stereo_decoder.h"
+
+#ifndef QUADRA_SYMBOL_RATE
+#define QUADRA_SYMBOL_RATE 9600
+#endif
+
+#ifndef QUADRA_PACKET_SIZE
+#define QUADRA_PACKET_SIZE 256
+#endif
+
+#ifndef QUADRA_BLOCK_SIZE
+#define QUADRA_BLOCK_SIZE 1024
+#endif
+
+#ifndef QUADRA_PARITY_PACKETS
+#define QUADRA_PARITY_PACKETS 0
+#endif
+
+#ifndef QUADRA_WINDOW_BITS
+#define QUADRA_WINDOW_BITS 0
+#endif
+
+#ifndef QUADRA_BITS_PER_SYMBOL
+#define QUADRA_BITS_PER_SYMBOL 4
+#endif
+
+namespace quadra
+{
+
+namespace tools
+{
+
+constexpr uint32_t kBlockSize = QUADRA_BLOCK_SIZE;
+
+template <uint32_t sample_rate>
+using MonoDecoder = Decoder<
+    sample_rate, QUADRA_SYMBOL_RATE,
+    QUADRA_PACKET_SIZE, QUADRA_BLOCK_SIZE,
+    256, float, Crc32,
+    QUADRA_PARITY_PACKETS, QUADRA_WINDOW_BITS, QUADRA_BITS_PER_SYMBOL>;
+
+template <uint32_t sample_rate>
+using StereoDecoder = quadra::StereoDecoder<
+    sample_rate, QUADRA_SYMBOL_RATE,
+    QUADRA_PACKET_SIZE, QUADRA_BLOCK_SIZE,
+    256, float, Crc32,
+    QUADRA_PARITY_PACKETS, QUADRA_WINDOW_BITS, QUADRA_BITS_PER_SYMBOL>;
+
+// Number of samples converted to float at a time. Small enough to stay in
+// L1 cache between conversion and demodulation.
+constexpr uint32_t kBatchSize = 2048;
+
+// Size of the read buffer used when the input can't be memory-mapped
+constexpr uint32_t kStreamBufferSize = 1 << 16;
+
+// Sequential byte source over either a memory-mapped file or a stream. Peek
+// exposes the bytes in place, so that mapped input is never copied.
+class Input
+{
+public:
+    bool Open(const char* path)
+    {
+        if (std::strcmp(path, "-") == 0)
+        {
+            fd_ = STDIN_FILENO;
+        }
+        else if ((fd_ = open(path, O_RDONLY)) < 0)
+        {
+            return false;
+        }
+
+        struct stat st;
+
+        if (fstat(fd_, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE,
+                fd_, 0);
+
+            if (map != MAP_FAILED)
+            {
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+                map_ = static_cast<const uint8_t*>(map);
+                map_size_ = st.st_size;
+                data_ = map_;
+                length_ = map_size_;
+                return true;
+            }
+        }
+
+        buffer_ = new uint8_t[kStreamBufferSize];
+        data_ = buffer_;
+        length_ = 0;
+        return true;
+    }
+
+    void Close(void)
+    {
+        if (map_)
+        {
+            munmap(const_cast<uint8_t*>(map_), map_size_);
+            map_ = nullptr;
+        }
+
+        delete[] buffer_;
+        buffer_ = nullptr;
+
+        if (fd_ > STDIN_FILENO)
+        {
+            close(fd_);
+        }
+
+        fd_ = -1;
+    }
+
+    // Returns the number of bytes available at data, refilling the stream
+    // buffer first if fewer than min_length are available. The result is
+    // less than min_length only at the end of the input.
+    size_t Peek(const uint8_t*& data, size_t min_length)
+    {
+        if (buffer_ && length_ < min_length)
+        {
+            std::memmove(buffer_, data_, length_);
+            data_ = buffer_;
+
+            while (length_ < min_length)
+            {
+                ssize_t n = read(fd_, buffer_ + length_,
+                    kStreamBufferSize - length_);
+
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                else if (n <= 0)
+                {
+                    break;
+                }
+
+                length_ += n;
+            }
+        }
+
+        data = data_;
+        return length_;
+    }
+
+    void Consume(size_t length)
+    {
+        data_ += length;
+        length_ -= length;
+    }
+
+    bool Read(void* dst, size_t length)
+    {
+        const uint8_t* data;
+
+        if (Peek(data, length) < length)
+        {
+            return false;
+        }
+
+        std::memcpy(dst, data, length);
+        Consume(length);
+        return true;
+    }
+
+    bool Skip(size_t length)
+    {
+        while (length)
+        {
+            const uint8_t* data;
+            size_t n = Peek(data, 1);
+
+            if (n == 0)
+            {
+                return false;
+            }
+
+            n = (n < length) ? n : length;
+            Consume(n);
+            length -= n;
+        }
+
+        return true;
+    }
+
+    bool mapped(void)
+    {
+        return map_ != nullptr;
+    }
+
+protected:
+    int fd_ = -1;
+    const uint8_t* map_ = nullptr;
+    size_t map_size_ = 0;
+    uint8_t* buffer_ = nullptr;
+    const uint8_t* data_ = nullptr;
+    size_t length_ = 0;
+};
+
+struct Format
+{
+    uint32_t sample_rate;
+    uint32_t num_channels;
+    uint64_t data_size;
+};
+
+inline uint32_t Load32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+}
+
+inline uint16_t Load16(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+// Parses the RIFF header and leaves the input positioned at the start of
+// the sample data. Returns a description of the problem on failure.
+inline const char* ReadHeader(Input& input, Format& format)
+{
+    uint8_t header[12];
+
+    if (!input.Read(header, sizeof(header)) ||
+        std::memcmp(header, "RIFF", 4) || std::memcmp(header + 8, "WAVE", 4))
+    {
+        return "not a WAV file";
+    }
+
+    bool has_format = false;
+
+    for (;;)
+    {
+        uint8_t chunk[8];
+
+        if (!input.Read(chunk, sizeof(chunk)))
+        {
+            return "no data chunk";
+        }
+
+        uint32_t size = Load32(chunk + 4);
+
+        if (std::memcmp(chunk, "fmt ", 4) == 0)
+        {
+            uint8_t fmt[16];
+
+            if (size < sizeof(fmt) || !input.Read(fmt, sizeof(fmt)) ||
+                !input.Skip(size - sizeof(fmt) + (size & 1)))
+            {
+                return "truncated fmt chunk";
+            }
+
+            uint16_t tag = Load16(fmt);
+            format.num_channels = Load16(fmt + 2);
+            format.sample_rate = Load32(fmt + 4);
+            uint16_t bits = Load16(fmt + 14);
+
+            if ((tag != 1 && tag != 0xFFFE) || bits != 16)
+            {
+                return "only 16-bit PCM is supported";
+            }
+
+            if (format.num_channels != 1 && format.num_channels != 2)
+            {
+                return "only mono and stereo are supported";
+            }
+
+            has_format = true;
+        }
+        else if (std::memcmp(chunk, "data", 4) == 0)
+        {
+            if (!has_format)
+            {
+                return "data chunk precedes fmt chunk";
+            }
+
+            // Streaming writers that can't seek back leave the size as 0 or
+            // 0xFFFFFFFF, in which case the data runs to the end of input.
+            format.data_size = (size == 0 || size == 0xFFFFFFFF) ?
+                UINT64_MAX : size;
+            return nullptr;
+        }
+        else if (!input.Skip(size + (size & 1)))
+        {
+            return "truncated chunk";
+        }
+    }
+}
+
+inline const char* ErrorName(Error error)
+{
+    switch (error)
+    {
+        case ERROR_SYNC:     return "sync";
+        case ERROR_CRC:      return "CRC";
+        case ERROR_OVERFLOW: return "overflow";
+        case ERROR_ABORT:    return "abort";
+        case ERROR_LENGTH:   return "length";
+        case ERROR_BUSY:     return "busy";
+        default:             return "none";
+    }
+}
+
+struct Stats
+{
+    uint64_t frames;
+    uint64_t bytes_received;
+    Result result;
+    Error error;
+};
+
+// Feeds the sample data to the decoder a batch at a time until the transfer
+// ends, fails, or the input runs out. Each received block is passed to
+// write_block. Blocks omitted from a sparse transfer are passed as null data,
+// to be filled with the fill byte.
+template <typename DecoderType, typename BlockWriter>
+Stats Decode(DecoderType& decoder, Input& input, const Format& format,
+    BlockWriter&& write_block)
+{
+    const uint32_t num_channels = format.num_channels;
+    const uint32_t frame_size = 2 * num_channels;
+    const uint32_t batch_frames = kBatchSize / num_channels;
+    uint64_t remaining = format.data_size;
+    float batch[kBatchSize];
+    Stats stats = {0, 0, RESULT_NONE, ERROR_NONE};
+
+    auto handle = [&](Result result)
+    {
+        stats.result = result;
+
+        if (result == RESULT_BLOCK_COMPLETE || result == RESULT_END)
+        {
+            uint32_t offset = (result == RESULT_END) ?
+                decoder.bytes_received() : decoder.block_offset();
+
+            if (offset > stats.bytes_received)
+            {
+                write_block(nullptr, offset - stats.bytes_received);
+                stats.bytes_received = offset;
+            }
+        }
+
+        if (result == RESULT_BLOCK_COMPLETE)
+        {
+            write_block(reinterpret_cast<const uint8_t*>(
+                decoder.block_data()), kBlockSize);
+            stats.bytes_received += kBlockSize;
+        }
+
+        return result != RESULT_END && result != RESULT_ERROR;
+    };
+
+    bool running = true;
+
+    while (running)
+    {
+        const uint8_t* data;
+        size_t length = input.Peek(data, frame_size);
+        length = (length < remaining) ? length : remaining;
+        uint32_t num_frames = length / frame_size;
+
+        if (num_frames == 0)
+        {
+            break;
+        }
+
+        num_frames = (num_frames < batch_frames) ? num_frames : batch_frames;
+        uint32_t num_samples = num_frames * num_channels;
+
+        for (uint32_t i = 0; i < num_samples; i++)
+        {
+            int16_t sample = Load16(data + 2 * i);
+            batch[i] = sample * (1.f / 32768);
+        }
+
+        input.Consume(num_frames * frame_size);
+        remaining -= num_frames * frame_size;
+        const float* buffer = batch;
+
+        while (running && num_frames)
+        {
+            uint32_t consumed;
+            running = handle(decoder.Process(buffer, num_frames, consumed));
+            buffer += consumed * num_channels;
+            num_frames -= consumed;
+            stats.frames += consumed;
+        }
+    }
+
+    // A block that completed on the very last sample may still have to be
+    // unpacked when decompression is enabled.
+    while (running && stats.result == RESULT_BLOCK_COMPLETE)
+    {
+        uint32_t consumed;
+        running = handle(decoder.Process(batch, 0, consumed));
+    }
+
+    stats.error = decoder.error();
+    return stats;
+}
+
+// How Intel HEX images are flattened, matching the encoder's
+// --start-address and --fill-byte options
+struct ImageOptions
+{
+    uint32_t fill_byte = 0xFF;
+    bool has_start_address = false;
+    uint32_t start_address = 0;
+};
+
+// Converts Intel HEX text to a flat image starting at start_address, or at
+// the lowest address in the file, with gaps filled as the encoder does.
+inline bool ParseHex(const std::string& text, const ImageOptions& options,
+    std::vector<uint8_t>& image, std::string& message)
+{
+    std::vector<std::pair<uint32_t, uint8_t>> bytes;
+    uint32_t base = 0;
+    size_t pos = 0;
+    uint32_t line = 0;
+
+    auto hex = [&](size_t at)
+    {
+        char s[3] = {text[at], text[at + 1], 0};
+        char* end;
+        uint32_t value = std::strtoul(s, &end, 16);
+        return (end == s + 2) ? int32_t(value) : -1;
+    };
+
+    while ((pos = text.find(':', pos)) != std::string::npos)
+    {
+        line++;
+        size_t eol = text.find_first_of("\r\n", pos);
+        eol = (eol == std::string::npos) ? text.size() : eol;
+        int32_t count = (eol - pos >= 11) ? hex(pos + 1) : -1;
+
+        if (count < 0 || eol - pos != 11 + 2 * size_t(count))
+        {
+            message = "malformed record on line " + std::to_string(line);
+            return false;
+        }
+
+        uint8_t record[260];
+        uint8_t sum = 0;
+
+        for (int32_t i = 0; i < count + 5; i++)
+        {
+            int32_t value = hex(pos + 1 + 2 * i);
+
+            if (value < 0)
+            {
+                message = "bad digit on line " + std::to_string(line);
+                return false;
+            }
+
+            record[i] = value;
+            sum += value;
+        }
+
+        if (sum != 0)
+        {
+            message = "bad checksum on line " + std::to_string(line);
+            return false;
+        }
+
+        uint32_t address = (record[1] << 8) | record[2];
+        uint8_t type = record[3];
+        const uint8_t* data = record + 4;
+
+        if (type == 0x00)
+        {
+            for (int32_t i = 0; i < count; i++)
+            {
+                bytes.emplace_back(base + address + i, data[i]);
+            }
+        }
+        else if (type == 0x01)
+        {
+            break;
+        }
+        else if (type == 0x02 && count == 2)
+        {
+            base = ((data[0] << 8) | data[1]) << 4;
+        }
+        else if (type == 0x04 && count == 2)
+        {
+            base = ((data[0] << 8) | data[1]) << 16;
+        }
+
+        pos = eol;
+    }
+
+    if (bytes.empty())
+    {
+        message = "no data records";
+        return false;
+    }
+
+    uint32_t lowest = bytes[0].first;
+    uint32_t highest = bytes[0].first;
+
+    for (auto& [address, value] : bytes)
+    {
+        lowest = std::min(lowest, address);
+        highest = std::max(highest, address);
+    }
+
+    uint32_t start = options.has_start_address ?
+        options.start_address : lowest;
+
+    if (highest < start)
+    {
+        message = "no data above the start address";
+        return false;
+    }
+
+    image.assign(highest - start + 1, options.fill_byte);
+
+    for (auto& [address, value] : bytes)
+    {
+        if (address >= start)
+        {
+            image[address - start] = value;
+        }
+    }
+
+    return true;
+}
+
+inline bool LoadImage(const std::string& path, const ImageOptions& options,
+    std::vector<uint8_t>& image, std::string& message)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file)
+    {
+        message = "can't open " + path;
+        return false;
+    }
+
+    std::string data((std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+
+    // Same detection as the encoder's --file-type auto
+    bool is_hex = std::filesystem::path(path).extension() == ".hex" ||
+        (!data.empty() && data.find_first_not_of(
+            "0123456789abcdefABCDEF:\r\n") == std::string::npos);
+
+    if (is_hex)
+    {
+        return ParseHex(data, options, image, message);
+    }
+
+    image.assign(data.begin(), data.end());
+    return true;
+}
+
+}
+
+}